@@ -0,0 +1,82 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TFC_BENCH_H
+#define TFC_BENCH_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+namespace Bench {
+
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * Returns the number of milliseconds since a point in time.
+     *
+     * @param start The point in time.
+     */
+    inline double elapsedMs(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    /**
+     * Parses a count given on the command line, falling back to a default if it is missing or invalid.
+     *
+     * @param argc The number of arguments.
+     * @param argv The arguments.
+     * @param index The index of the argument holding the count.
+     * @param fallback The count used if the argument is missing or invalid.
+     */
+    inline uint64_t parseCount(int argc, char** argv, int index, uint64_t fallback) {
+        if(argc <= index)
+            return fallback;
+        char* end = nullptr;
+        unsigned long long count = std::strtoull(argv[index], &end, 10);
+        return (end == argv[index] || *end != '\0' || count == 0) ? fallback : count;
+    }
+
+    /**
+     * Removes a container file along with its journal.
+     *
+     * @param filename The path of the container.
+     */
+    inline void removeContainer(const std::string &filename) {
+        std::remove(filename.c_str());
+        std::remove((filename + ".tfj").c_str());
+    }
+
+    /**
+     * Returns the resident set size of this process in KiB, or 0 if it can't be read.
+     */
+    inline long residentKb() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while(std::getline(status, line)) {
+            if(line.compare(0, 6, "VmRSS:") == 0)
+                return std::stol(line.substr(6));
+        }
+        return 0;
+    }
+
+}
+
+#endif //TFC_BENCH_H
@@ -0,0 +1,179 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <bench.h>
+#include <iostream>
+#include <random>
+#include <sys/stat.h>
+#include <vector>
+#include <tfc/exception.h>
+#include <tfc/file.h>
+
+/*
+ * Measures the ingest throughput and the deduplication ratio of each deduplication mode on synthetic datasets. The
+ * ratio is the number of bytes stashed divided by the size of the container, so it includes the tables.
+ *
+ * Usage: tfc-bench-dedup [MiB per dataset] [container path]
+ */
+
+static const uint64_t DEFAULT_DATASET_MIB = 64;
+static const uint64_t FILE_SIZE = 1048576;    // size of the files in the unique, copies and edited datasets
+static const uint64_t APPEND_SIZE = 65536;    // bytes appended to each version of the log in the appended dataset
+static const unsigned int COPY_COUNT = 4;     // times each file is repeated in the copies dataset
+static const unsigned int EDIT_COUNT = 8;     // small edits in each version in the edited dataset
+static const uint32_t BLOCK_SIZE = 4096;
+
+typedef std::vector<std::vector<char>> Dataset;
+
+/**
+ * Fills a buffer with random bytes.
+ */
+static void randomize(std::vector<char> &bytes, std::mt19937_64 &rng) {
+    for(char &byte : bytes)
+        byte = static_cast<char>(rng());
+}
+
+/**
+ * Files of random bytes which share nothing.
+ */
+static Dataset uniqueFiles(uint64_t total, std::mt19937_64 &rng) {
+    Dataset files;
+    for(uint64_t size = 0; size < total; size += FILE_SIZE) {
+        files.emplace_back(FILE_SIZE);
+        randomize(files.back(), rng);
+    }
+    return files;
+}
+
+/**
+ * Files of random bytes, each of which appears several times.
+ */
+static Dataset copiedFiles(uint64_t total, std::mt19937_64 &rng) {
+    Dataset files;
+    while(files.size() * FILE_SIZE < total) {
+        std::vector<char> file(FILE_SIZE);
+        randomize(file, rng);
+        for(unsigned int i = 0; i < COPY_COUNT; i++)
+            files.push_back(file);
+    }
+    return files;
+}
+
+/**
+ * Versions of a log file, each of which is the version before with more random lines appended.
+ */
+static Dataset appendedFiles(uint64_t total, std::mt19937_64 &rng) {
+    Dataset files;
+    std::vector<char> log;
+    uint64_t size = 0;
+    while(size < total) {
+        std::vector<char> lines(APPEND_SIZE);
+        for(uint64_t i = 0; i < APPEND_SIZE; i++)
+            lines[i] = (i % 64 == 63) ? '\n' : static_cast<char>('a' + rng() % 26);
+        log.insert(log.end(), lines.begin(), lines.end());
+        files.push_back(log);
+        size += log.size();
+    }
+    return files;
+}
+
+/**
+ * Versions of a file of random bytes, each with a few bytes inserted, overwritten or removed at random places.
+ */
+static Dataset editedFiles(uint64_t total, std::mt19937_64 &rng) {
+    Dataset files;
+    std::vector<char> file(FILE_SIZE);
+    randomize(file, rng);
+    for(uint64_t size = 0; size < total; size += file.size()) {
+        for(unsigned int i = 0; i < EDIT_COUNT; i++) {
+            auto pos = file.begin() + static_cast<std::ptrdiff_t>(rng() % file.size());
+            switch(rng() % 3) {
+                case 0:
+                    file.insert(pos, static_cast<char>(rng()));
+                    break;
+                case 1:
+                    *pos = static_cast<char>(rng());
+                    break;
+                default:
+                    file.erase(pos);
+                    break;
+            }
+        }
+        files.push_back(file);
+    }
+    return files;
+}
+
+/**
+ * Stashes a dataset into a new container and prints the throughput and the deduplication ratio.
+ *
+ * @param filename The path of the container.
+ * @param dataset The files to stash.
+ * @param mode The name of the deduplication mode: off, whole or chunks.
+ */
+static void ingest(const std::string &filename, Dataset &dataset, const std::string &mode) {
+    Bench::removeContainer(filename);
+    Tfc::File file(filename);
+    file.mode(Tfc::FileMode::CREATE);
+    file.init(BLOCK_SIZE);
+    file.mode(Tfc::FileMode::READ);
+    file.mode(Tfc::FileMode::EDIT);
+    file.setDeduplication(mode != "off");
+    file.setChunking(mode == "chunks");
+
+    // stash every file, the time includes writing the tables and flushing the container
+    uint64_t logical = 0;
+    Bench::Clock::time_point start = Bench::Clock::now();
+    for(size_t i = 0; i < dataset.size(); i++) {
+        file.addBlob("file_" + std::to_string(i), dataset[i].data(), dataset[i].size());
+        logical += dataset[i].size();
+    }
+    file.mode(Tfc::FileMode::CLOSED);
+    double elapsed = Bench::elapsedMs(start);
+
+    struct stat info = {};
+    stat(filename.c_str(), &info);
+    std::printf("%-8s %10.1f %12.1f %8.2f\n", mode.c_str(), static_cast<double>(logical) / 1048576,
+                static_cast<double>(logical) / 1048576 / (elapsed / 1000),
+                static_cast<double>(logical) / static_cast<double>(info.st_size));
+}
+
+int main(int argc, char** argv) {
+    uint64_t total = Bench::parseCount(argc, argv, 1, DEFAULT_DATASET_MIB) * 1048576;
+    std::string filename = argc > 2 ? argv[2] : "tfc-bench-dedup.tfc";
+
+    std::mt19937_64 rng(1);
+    const std::vector<std::pair<std::string, Dataset (*)(uint64_t, std::mt19937_64 &)>> DATASETS = {
+        { "unique", uniqueFiles }, { "copies", copiedFiles }, { "appended", appendedFiles }, { "edited", editedFiles }
+    };
+    try {
+        for(const auto &dataset : DATASETS) {
+            Dataset files = dataset.second(total, rng);
+            std::printf("\n%s: %zu files\n", dataset.first.c_str(), files.size());
+            std::printf("%-8s %10s %12s %8s\n", "mode", "MiB", "MiB/s", "ratio");
+            for(const char* mode : { "off", "whole", "chunks" })
+                ingest(filename, files, mode);
+        }
+    } catch(Tfc::Exception &ex) {
+        std::cerr << "tfc-bench-dedup: " << ex.what() << "\n";
+        Bench::removeContainer(filename);
+        return 1;
+    }
+
+    Bench::removeContainer(filename);
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <bench.h>
+#include <iostream>
+#include <tfc/exception.h>
+#include <tfc/file.h>
+
+/*
+ * Measures how long it takes to open a container in READ mode as the number of blobs in it grows. Each container is
+ * filled with small blobs, a third of which are tagged, and then opened by a new File so that its tables are parsed
+ * from the disk.
+ *
+ * Usage: tfc-bench-open [max blobs] [container path]
+ */
+
+static const uint64_t DEFAULT_MAX_BLOBS = 1000000;
+static const unsigned int OPEN_RUNS = 3;  // opens timed per container, the fastest is reported
+static const unsigned int TAG_COUNT = 97; // distinct tags attached to the blobs
+
+/**
+ * Fills a new container with a number of blobs.
+ *
+ * @param filename The path of the container.
+ * @param blobCount The number of blobs to add.
+ */
+static void fill(const std::string &filename, uint64_t blobCount) {
+    Bench::removeContainer(filename);
+    Tfc::File file(filename);
+    file.mode(Tfc::FileMode::CREATE);
+    file.init(512);
+    file.mode(Tfc::FileMode::READ);
+    file.mode(Tfc::FileMode::EDIT);
+
+    // one transaction writes the tables once, so filling doesn't dominate the run
+    file.begin();
+    for(uint64_t i = 0; i < blobCount; i++) {
+        uint64_t contents = i;
+        uint32_t nonce = file.addBlob("blob_" + std::to_string(i), reinterpret_cast<char*>(&contents),
+                                      sizeof(contents));
+        if(i % 3 == 0)
+            file.attachTag(nonce, "tag" + std::to_string(i % TAG_COUNT));
+    }
+    file.commit();
+    file.mode(Tfc::FileMode::CLOSED);
+}
+
+int main(int argc, char** argv) {
+    uint64_t maxBlobs = Bench::parseCount(argc, argv, 1, DEFAULT_MAX_BLOBS);
+    std::string filename = argc > 2 ? argv[2] : "tfc-bench-open.tfc";
+
+    std::printf("%12s %12s %14s %14s\n", "blobs", "open (ms)", "per blob (ns)", "tables (MiB)");
+    try {
+        for(uint64_t blobCount = 1000; blobCount <= maxBlobs; blobCount *= 10) {
+            fill(filename, blobCount);
+
+            // a new File has no tables in memory, so every open parses them
+            double fastest = 0;
+            long tablesKb = 0;
+            for(unsigned int run = 0; run < OPEN_RUNS; run++) {
+                long before = Bench::residentKb();
+                Bench::Clock::time_point start = Bench::Clock::now();
+                Tfc::File file(filename);
+                file.mode(Tfc::FileMode::READ);
+                double elapsed = Bench::elapsedMs(start);
+                if(run == 0 || elapsed < fastest)
+                    fastest = elapsed;
+                if(run == 0) // later runs reuse the memory freed by the one before
+                    tablesKb = Bench::residentKb() - before;
+            }
+
+            std::printf("%12llu %12.2f %14.1f %14.1f\n", static_cast<unsigned long long>(blobCount), fastest,
+                        fastest * 1e6 / static_cast<double>(blobCount), static_cast<double>(tablesKb) / 1024);
+        }
+    } catch(Tfc::Exception &ex) {
+        std::cerr << "tfc-bench-open: " << ex.what() << "\n";
+        Bench::removeContainer(filename);
+        return 1;
+    }
+
+    Bench::removeContainer(filename);
+    return 0;
+}
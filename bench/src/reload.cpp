@@ -0,0 +1,171 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <atomic>
+#include <bench.h>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <tfc/exception.h>
+#include <tfc/file.h>
+
+/*
+ * Measures the cost of reading a container's tables again once another process has changed them. A reader opens a
+ * container of small, tagged blobs, then a child process adds a blob between each of the reader's reads, so that every
+ * read parses the tables again into memory the reader already holds. The time of each read, the heap allocations it
+ * makes and the reader's resident memory are reported, which should stay flat from one read to the next.
+ *
+ * Usage: tfc-bench-reload [blobs] [reloads] [container path]
+ */
+
+static const uint64_t DEFAULT_BLOBS = 1000000;
+static const uint64_t DEFAULT_RELOADS = 5;
+static const unsigned int TAG_COUNT = 97; // distinct tags attached to the blobs
+
+// number of times the heap has been allocated from
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations++;
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if(memory == nullptr)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+/**
+ * Adds a number of blobs to a new container, a third of them tagged.
+ *
+ * @param filename The path of the container.
+ * @param blobCount The number of blobs to add.
+ */
+static void fillContainer(const std::string &filename, uint64_t blobCount) {
+    Bench::removeContainer(filename);
+    Tfc::File file(filename);
+    file.mode(Tfc::FileMode::CREATE);
+    file.init(512);
+    file.mode(Tfc::FileMode::READ);
+    file.mode(Tfc::FileMode::EDIT);
+
+    file.begin();
+    for(uint64_t i = 0; i < blobCount; i++) {
+        uint64_t contents = i;
+        uint32_t nonce = file.addBlob("photos/blob_" + std::to_string(i) + ".jpg",
+                                      reinterpret_cast<char*>(&contents), sizeof(contents));
+        if(i % 3 == 0)
+            file.attachTag(nonce, "tag" + std::to_string(i % TAG_COUNT));
+    }
+    file.commit();
+    file.mode(Tfc::FileMode::CLOSED);
+}
+
+/**
+ * Adds a blob to a container.
+ *
+ * @param filename The path of the container.
+ * @param index The number of blobs added so far, used to name the blob.
+ */
+static void addBlob(const std::string &filename, uint64_t index) {
+    Tfc::File file(filename);
+    file.mode(Tfc::FileMode::READ);
+    file.mode(Tfc::FileMode::EDIT);
+    file.addBlob("photos/added_" + std::to_string(index) + ".jpg", reinterpret_cast<char*>(&index), sizeof(index));
+    file.mode(Tfc::FileMode::CLOSED);
+}
+
+/**
+ * Runs a change to a container in a child process, so that the memory used to make it isn't counted as the reader's.
+ *
+ * @param change The change, which is called with no arguments.
+ * @throw Exception The change failed.
+ */
+template<typename Change>
+static void inChild(Change change) {
+    pid_t child = fork();
+    if(child < 0)
+        throw Tfc::Exception("Failed to start the process changing the container");
+    if(child > 0) {
+        int status = 0;
+        if(waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            throw Tfc::Exception("Failed to change the container");
+        return;
+    }
+
+    try {
+        change();
+    } catch(Tfc::Exception &ex) {
+        std::cerr << "tfc-bench-reload: " << ex.what() << std::endl;
+        _exit(1);
+    }
+    _exit(0);
+}
+
+/**
+ * Opens a container in READ mode and reports the time, allocations and memory it took.
+ *
+ * @param file The container.
+ * @param label The name of the read in the report.
+ * @param blobCount The number of blobs the container should hold.
+ * @throw Exception The container doesn't hold the expected number of blobs.
+ */
+static void timeRead(Tfc::File &file, const std::string &label, uint64_t blobCount) {
+    uint64_t allocated = allocations;
+    Bench::Clock::time_point start = Bench::Clock::now();
+    file.mode(Tfc::FileMode::READ);
+    double elapsed = Bench::elapsedMs(start);
+    allocated = allocations - allocated;
+
+    if(file.listBlobs().size() != blobCount)
+        throw Tfc::Exception("The " + label + " found the wrong number of blobs");
+    std::printf("%-12s %10.1f %14llu %12.1f\n", label.c_str(), elapsed, static_cast<unsigned long long>(allocated),
+                static_cast<double>(Bench::residentKb()) / 1024);
+    file.mode(Tfc::FileMode::CLOSED);
+}
+
+int main(int argc, char** argv) {
+    uint64_t blobCount = Bench::parseCount(argc, argv, 1, DEFAULT_BLOBS);
+    uint64_t reloads = Bench::parseCount(argc, argv, 2, DEFAULT_RELOADS);
+    std::string filename = argc > 3 ? argv[3] : "tfc-bench-reload.tfc";
+
+    try {
+        inChild([&]() { fillContainer(filename, blobCount); });
+
+        Tfc::File reader(filename);
+        std::printf("%-12s %10s %14s %12s\n", "", "time (ms)", "allocations", "RSS (MiB)");
+        timeRead(reader, "first read", blobCount);
+        timeRead(reader, "unchanged", blobCount);
+
+        // each change leaves the reader's tables stale, so they are parsed again into the memory they were in
+        for(uint64_t i = 0; i < reloads; i++) {
+            inChild([&]() { addBlob(filename, i); });
+            timeRead(reader, "reload " + std::to_string(i + 1), ++blobCount);
+        }
+    } catch(Tfc::Exception &ex) {
+        std::cerr << "tfc-bench-reload: " << ex.what() << "\n";
+        Bench::removeContainer(filename);
+        return 1;
+    }
+
+    Bench::removeContainer(filename);
+    return 0;
+}
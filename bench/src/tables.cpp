@@ -0,0 +1,235 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <bench.h>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include <tfc/exception.h>
+#include <tfc/file.h>
+
+/*
+ * Measures the blob table against the node-based maps it replaced. A container of small blobs is filled and opened,
+ * which gives the time to load its tables and the memory they take. The loaded records are then indexed again both by
+ * a BlobTable and by the maps, a nonce map, name and hash multimaps and an ordered name multimap, and the same random
+ * lookups are timed on each.
+ *
+ * Usage: tfc-bench-tables [blobs] [container path]
+ */
+
+static const uint64_t DEFAULT_BLOBS = 1000000;
+static const unsigned int LOOKUPS = 100000;  // random lookups timed of each kind
+static const unsigned int TAG_COUNT = 97;    // distinct tags attached to the blobs
+
+// the indexes the blob table was made of before it stored its rows and indexes in flat arrays
+struct NodeTable {
+    std::map<uint32_t, Tfc::BlobRecord*> rows;
+    std::unordered_multimap<uint64_t, Tfc::BlobRecord*> hashMap;
+    std::unordered_multimap<std::string, Tfc::BlobRecord*> nameMap;
+    std::multimap<std::string, Tfc::BlobRecord*> nameIndex;
+};
+
+/**
+ * Adds a number of blobs to a new container, a third of them tagged.
+ *
+ * @param filename The path of the container.
+ * @param blobCount The number of blobs to add.
+ */
+static void fillContainer(const std::string &filename, uint64_t blobCount) {
+    Tfc::File file(filename);
+    file.mode(Tfc::FileMode::CREATE);
+    file.init(512);
+    file.mode(Tfc::FileMode::READ);
+    file.mode(Tfc::FileMode::EDIT);
+
+    file.begin();
+    for(uint64_t i = 0; i < blobCount; i++) {
+        uint64_t contents = i;
+        uint32_t nonce = file.addBlob("photos/blob_" + std::to_string(i) + ".jpg",
+                                      reinterpret_cast<char*>(&contents), sizeof(contents));
+        if(i % 3 == 0)
+            file.attachTag(nonce, "tag" + std::to_string(i % TAG_COUNT));
+    }
+    file.commit();
+    file.mode(Tfc::FileMode::CLOSED);
+}
+
+/**
+ * Fills a new container in a child process, so that the memory used to fill it isn't reused by the tables measured
+ * afterwards.
+ *
+ * @param filename The path of the container.
+ * @param blobCount The number of blobs to add.
+ * @throw Exception The container couldn't be filled.
+ */
+static void fill(const std::string &filename, uint64_t blobCount) {
+    Bench::removeContainer(filename);
+    pid_t child = fork();
+    if(child < 0)
+        throw Tfc::Exception("Failed to start the process filling the container");
+    if(child > 0) {
+        int status = 0;
+        if(waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            throw Tfc::Exception("Failed to fill the container");
+        return;
+    }
+
+    try {
+        fillContainer(filename, blobCount);
+    } catch(Tfc::Exception &ex) {
+        std::cerr << "tfc-bench-tables: " << ex.what() << std::endl;
+        _exit(1);
+    }
+    _exit(0);
+}
+
+/**
+ * Times a lookup run on each of a list of blobs.
+ *
+ * @param blobs The blobs to look up.
+ * @param lookup The lookup, which returns the number of rows it found.
+ * @return The average time of a lookup in nanoseconds.
+ */
+template<typename Lookup>
+static double timeLookups(const std::vector<Tfc::BlobRecord*> &blobs, Lookup lookup) {
+    uint64_t found = 0;
+    Bench::Clock::time_point start = Bench::Clock::now();
+    for(Tfc::BlobRecord* blob : blobs)
+        found += lookup(blob);
+    double elapsed = Bench::elapsedMs(start);
+    if(found < blobs.size())
+        throw Tfc::Exception("A lookup didn't find its blob");
+    return elapsed * 1e6 / static_cast<double>(blobs.size());
+}
+
+int main(int argc, char** argv) {
+    uint64_t blobCount = Bench::parseCount(argc, argv, 1, DEFAULT_BLOBS);
+    std::string filename = argc > 2 ? argv[2] : "tfc-bench-tables.tfc";
+
+    try {
+        fill(filename, blobCount);
+
+        // open the container with a new File, so that its tables are parsed from the disk
+        long before = Bench::residentKb();
+        Bench::Clock::time_point start = Bench::Clock::now();
+        Tfc::File file(filename);
+        file.mode(Tfc::FileMode::READ);
+        double loadMs = Bench::elapsedMs(start);
+        long loadKb = Bench::residentKb() - before;
+        std::printf("%llu blobs: tables loaded in %.1f ms (%.0f ns per blob), %.1f MiB\n\n",
+                    static_cast<unsigned long long>(blobCount), loadMs, loadMs * 1e6 / static_cast<double>(blobCount),
+                    static_cast<double>(loadKb) / 1024);
+
+        std::vector<Tfc::BlobRecord*> blobs = file.listBlobs();
+        std::vector<Tfc::BlobRecord*> sample;
+        std::mt19937 rng(1);
+        for(unsigned int i = 0; i < LOOKUPS; i++)
+            sample.push_back(blobs[rng() % blobs.size()]);
+
+        // index the records again, first the way the blob table does
+        before = Bench::residentKb();
+        start = Bench::Clock::now();
+        Tfc::BlobTable flat;
+        flat.reserve(static_cast<uint32_t>(blobs.size()));
+        for(Tfc::BlobRecord* blob : blobs)
+            flat.add(blob);
+        flat.getByNamePrefix(""); // sorts the ordered name index, which is otherwise done by the first prefix lookup
+        double flatMs = Bench::elapsedMs(start);
+        long flatKb = Bench::residentKb() - before;
+
+        // then with the node-based maps
+        before = Bench::residentKb();
+        start = Bench::Clock::now();
+        NodeTable nodes;
+        nodes.hashMap.reserve(blobs.size());
+        nodes.nameMap.reserve(blobs.size());
+        for(Tfc::BlobRecord* blob : blobs) {
+            nodes.rows.insert({ blob->getNonce(), blob });
+            nodes.hashMap.insert({ blob->getHash(), blob });
+            nodes.nameMap.insert({ blob->getName(), blob });
+            nodes.nameIndex.insert({ blob->getName(), blob });
+        }
+        double nodeMs = Bench::elapsedMs(start);
+        long nodeKb = Bench::residentKb() - before;
+
+        std::printf("%-22s %14s %14s\n", "", "flat arrays", "node maps");
+        std::printf("%-22s %14.1f %14.1f\n", "index (ms)", flatMs, nodeMs);
+        std::printf("%-22s %14.1f %14.1f\n", "index (MiB)", static_cast<double>(flatKb) / 1024,
+                    static_cast<double>(nodeKb) / 1024);
+
+        // the names are copied out before the timing starts, since getName() makes a string
+        std::vector<std::string> names;
+        for(Tfc::BlobRecord* blob : sample)
+            names.push_back(blob->getName());
+        size_t next = 0;
+
+        std::printf("%-22s %14.1f %14.1f\n", "nonce lookup (ns)",
+                    timeLookups(sample, [&](Tfc::BlobRecord* blob) {
+                        return flat.get(blob->getNonce()) == blob ? 1 : 0;
+                    }),
+                    timeLookups(sample, [&](Tfc::BlobRecord* blob) {
+                        return nodes.rows.find(blob->getNonce())->second == blob ? 1 : 0;
+                    }));
+        std::printf("%-22s %14.1f %14.1f\n", "hash lookup (ns)",
+                    timeLookups(sample, [&](Tfc::BlobRecord* blob) {
+                        return flat.getByHash(blob->getHash()).size();
+                    }),
+                    timeLookups(sample, [&](Tfc::BlobRecord* blob) {
+                        std::vector<Tfc::BlobRecord*> rows;
+                        auto range = nodes.hashMap.equal_range(blob->getHash());
+                        for(auto iter = range.first; iter != range.second; iter++)
+                            rows.push_back(iter->second);
+                        return rows.size();
+                    }));
+        std::printf("%-22s %14.1f", "name lookup (ns)",
+                    timeLookups(sample, [&](Tfc::BlobRecord*) {
+                        return flat.getByName(names[next++ % names.size()]).size();
+                    }));
+        std::printf(" %14.1f\n", timeLookups(sample, [&](Tfc::BlobRecord*) {
+                        std::vector<Tfc::BlobRecord*> rows;
+                        auto range = nodes.nameMap.equal_range(names[next++ % names.size()]);
+                        for(auto iter = range.first; iter != range.second; iter++)
+                            rows.push_back(iter->second);
+                        std::sort(rows.begin(), rows.end(), Tfc::Record::asc);
+                        return rows.size();
+                    }));
+        std::printf("%-22s %14.1f", "prefix lookup (ns)",
+                    timeLookups(sample, [&](Tfc::BlobRecord*) {
+                        return flat.getByNamePrefix(names[next++ % names.size()]).size();
+                    }));
+        std::printf(" %14.1f\n", timeLookups(sample, [&](Tfc::BlobRecord*) {
+                        const std::string &prefix = names[next++ % names.size()];
+                        std::vector<Tfc::BlobRecord*> rows;
+                        for(auto iter = nodes.nameIndex.lower_bound(prefix); iter != nodes.nameIndex.end()
+                            && iter->first.compare(0, prefix.size(), prefix) == 0; iter++)
+                            rows.push_back(iter->second);
+                        return rows.size();
+                    }));
+    } catch(Tfc::Exception &ex) {
+        std::cerr << "tfc-bench-tables: " << ex.what() << "\n";
+        Bench::removeContainer(filename);
+        return 1;
+    }
+
+    Bench::removeContainer(filename);
+    return 0;
+}
@@ -0,0 +1,19 @@
+/*
+ * zstd uses the xxHash vendored in lib/xxhash rather than a copy of its own. Its symbols are prefixed with ZSTD_ so
+ * that they never clash with the ones the rest of the project links against, and XXH3 is left out since zstd doesn't
+ * use it.
+ */
+#ifndef ZSTD_XXHASH_H
+#define ZSTD_XXHASH_H
+
+#ifndef XXH_NO_XXH3
+# define XXH_NO_XXH3
+#endif
+
+#ifndef XXH_NAMESPACE
+# define XXH_NAMESPACE ZSTD_
+#endif
+
+#include <xxhash/xxhash.h>
+
+#endif /* ZSTD_XXHASH_H */
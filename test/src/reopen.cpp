@@ -0,0 +1,103 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include <tfc/exception.h>
+#include <tfc/file.h>
+
+/*
+ * Entering EDIT mode with tables which haven't been read, or which another writer has changed, replays the table log.
+ * A blob deleted earlier in the log has its blocks taken by a blob added later in it, and a blob added by the next
+ * writer must not be given those blocks again.
+ */
+
+static const char* FILENAME = "tfc-test-reopen.tfc";
+static const uint64_t BLOB_SIZE = 2500; // spans several blocks
+
+/**
+ * Adds a blob filled with one byte.
+ *
+ * @param file The container, in EDIT mode.
+ * @param fill The byte.
+ * @return The nonce of the blob.
+ */
+static uint32_t addBlob(Tfc::File &file, char fill) {
+    std::vector<char> bytes(BLOB_SIZE, fill);
+    return file.addBlob(std::string(1, fill), bytes.data(), bytes.size());
+}
+
+/**
+ * Whether a blob holds the bytes it was added with.
+ *
+ * @param file The container, in READ mode.
+ * @param nonce The nonce of the blob.
+ * @param fill The byte the blob was filled with.
+ */
+static bool isIntact(Tfc::File &file, uint32_t nonce, char fill) {
+    Tfc::Blob* blob = file.readBlob(nonce);
+    bool intact = blob != nullptr && blob->record->getSize() == BLOB_SIZE;
+    for(uint64_t i = 0; intact && i < BLOB_SIZE; i++)
+        intact = blob->data[i] == fill;
+    if(blob != nullptr) {
+        delete [] blob->data;
+        delete blob;
+    }
+    return intact;
+}
+
+int main() {
+    std::remove(FILENAME);
+    std::remove((std::string(FILENAME) + ".tfj").c_str());
+
+    bool passed;
+    try {
+        uint32_t b;
+        {
+            Tfc::File file(FILENAME);
+            file.mode(Tfc::FileMode::CREATE);
+            file.init(512);
+            file.mode(Tfc::FileMode::READ);
+            file.mode(Tfc::FileMode::EDIT);
+
+            // b reuses the blocks of a, whose deletion has been committed
+            file.deleteBlob(addBlob(file, 'a'));
+            file.sync();
+            b = addBlob(file, 'b');
+            file.mode(Tfc::FileMode::CLOSED);
+        }
+
+        // a new writer goes straight into EDIT mode, which reads the tables and replays the log
+        Tfc::File file(FILENAME);
+        file.mode(Tfc::FileMode::EDIT);
+        uint32_t c = addBlob(file, 'c');
+
+        file.mode(Tfc::FileMode::READ);
+        passed = isIntact(file, b, 'b') && isIntact(file, c, 'c');
+        file.mode(Tfc::FileMode::CLOSED);
+    } catch(Tfc::Exception &ex) {
+        std::cerr << "tfc-test-reopen: " << ex.what() << "\n";
+        passed = false;
+    }
+
+    std::remove(FILENAME);
+    std::remove((std::string(FILENAME) + ".tfj").c_str());
+    if(!passed)
+        std::cerr << "tfc-test-reopen: a blob added by a new writer overwrote a blob added by the last one\n";
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include <tfc/exception.h>
+#include <tfc/file.h>
+
+/*
+ * Rolling back a transaction replays the table log. A blob deleted and committed earlier in the log has its blocks
+ * taken by a blob added later in the log, and the blocks must stay in use once the log has been replayed, rather than
+ * being freed and handed to the next blob.
+ */
+
+static const char* FILENAME = "tfc-test-rollback.tfc";
+static const uint64_t BLOB_SIZE = 2500; // spans several blocks
+
+/**
+ * Adds a blob filled with one byte.
+ *
+ * @param file The container, in EDIT mode.
+ * @param fill The byte.
+ * @return The nonce of the blob.
+ */
+static uint32_t addBlob(Tfc::File &file, char fill) {
+    std::vector<char> bytes(BLOB_SIZE, fill);
+    return file.addBlob(std::string(1, fill), bytes.data(), bytes.size());
+}
+
+/**
+ * Whether a blob holds the bytes it was added with.
+ *
+ * @param file The container, in READ mode.
+ * @param nonce The nonce of the blob.
+ * @param fill The byte the blob was filled with.
+ */
+static bool isIntact(Tfc::File &file, uint32_t nonce, char fill) {
+    Tfc::Blob* blob = file.readBlob(nonce);
+    bool intact = blob != nullptr && blob->record->getSize() == BLOB_SIZE;
+    for(uint64_t i = 0; intact && i < BLOB_SIZE; i++)
+        intact = blob->data[i] == fill;
+    if(blob != nullptr) {
+        delete [] blob->data;
+        delete blob;
+    }
+    return intact;
+}
+
+int main() {
+    std::remove(FILENAME);
+    std::remove((std::string(FILENAME) + ".tfj").c_str());
+
+    bool passed;
+    try {
+        Tfc::File file(FILENAME);
+        file.mode(Tfc::FileMode::CREATE);
+        file.init(512);
+        file.mode(Tfc::FileMode::READ);
+        file.mode(Tfc::FileMode::EDIT);
+
+        // b reuses the blocks of a, whose deletion has been committed
+        file.deleteBlob(addBlob(file, 'a'));
+        file.sync();
+        uint32_t b = addBlob(file, 'b');
+
+        // the rollback replays the log, then c must be given blocks of its own
+        file.begin();
+        file.rollback();
+        uint32_t c = addBlob(file, 'c');
+
+        file.mode(Tfc::FileMode::READ);
+        passed = isIntact(file, b, 'b') && isIntact(file, c, 'c');
+        file.mode(Tfc::FileMode::CLOSED);
+    } catch(Tfc::Exception &ex) {
+        std::cerr << "tfc-test-rollback: " << ex.what() << "\n";
+        passed = false;
+    }
+
+    std::remove(FILENAME);
+    std::remove((std::string(FILENAME) + ".tfj").c_str());
+    if(!passed)
+        std::cerr << "tfc-test-rollback: a blob added after the rollback overwrote a blob added before it\n";
+    return passed ? 0 : 1;
+}
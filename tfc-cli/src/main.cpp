@@ -23,6 +23,8 @@
 #include <cmath>
 #include <csignal>
 #include <mutex>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <tasker/tasker.h>
 #include <tfc/file.h>
 #include "terminal.h"
@@ -46,16 +48,21 @@ enum ResultType {
  */
 void about();
 void await(Tasker::Task* task, const std::string &message);
+uint32_t copyToWriter(Tfc::BlobWriter* writer, const std::string &path);
 void help();
 std::string join(const std::vector<std::string> &strings, const std::string &delim);
 int license();
 int license(std::string name);
 std::vector<std::string> parseInput(const std::string &input);
+uint32_t parseSize(const std::string &size);
+void printBlob(Tfc::BlobRecord* record);
+void printBlobHeader();
 void printBlobs(const std::vector<Tfc::BlobRecord*> &blobs);
 std::vector<std::string> split(const std::string &string, char delim);
 uint32_t stash(Tfc::File* file, const std::string &filename, const std::string &path);
+std::vector<std::pair<std::string, uint32_t>> stashDirectory(Tfc::File* file, const std::string &path);
 std::string status(ResultType resultType);
-Tfc::BlobRecord* unstash(Tfc::File* file, uint32_t id, const std::string &filename = "");
+std::string unstash(Tfc::File* file, uint32_t id, const std::string &filename = "");
 
 /**
  * Global variables
@@ -257,11 +264,40 @@ int main(int argc, char** argv) {
             }
 
             // init command
-            if (args[0] == "init") {
+            if (args[0] == "init" && args.size() <= 2) {
+                uint32_t blockSize = Tfc::File::DEFAULT_BLOCK_SIZE;
+                if (args.size() == 2)
+                    blockSize = parseSize(args[1]);
+                if (!Tfc::File::isValidBlockSize(blockSize))
+                    throw Tfc::Exception("Block size must be a power of two from 512 to 1m");
+
                 file->mode(Tfc::FileMode::CREATE);
-                file->init();
+                file->init(blockSize);
                 file->mode(Tfc::FileMode::READ);
-                std::cout << status(ResultType::SUCCESS) << "Created container file at " << filename << "\n";
+                std::cout << status(ResultType::SUCCESS) << "Created container file at " << filename << " with "
+                          << blockSize << " byte blocks\n";
+                continue;
+            }
+
+            // compress command
+            if (args[0] == "compress" && args.size() == 2) {
+                if (args[1] != "on" && args[1] != "off")
+                    throw Tfc::Exception("Compression must be on or off");
+                file->setCompression(args[1] == "on");
+                std::cout << status(ResultType::SUCCESS) << "Compression is " << args[1]
+                          << " for files stashed from now on\n";
+                continue;
+            }
+
+            // dedup command
+            if (args[0] == "dedup" && args.size() == 2) {
+                if (args[1] != "on" && args[1] != "chunks" && args[1] != "off")
+                    throw Tfc::Exception("Deduplication must be on, chunks or off");
+                file->setDeduplication(args[1] != "off");
+                file->setChunking(args[1] == "chunks");
+                std::cout << status(ResultType::SUCCESS) << (args[1] == "chunks" ? "Chunk deduplication is on" :
+                                                             "Deduplication is " + args[1])
+                          << " for files stashed from now on\n";
                 continue;
             }
 
@@ -273,9 +309,9 @@ int main(int argc, char** argv) {
             }
 
             // list tags command
-            if(args[0] == "tags") {
+            if(args[0] == "tags" && args.size() <= 2) {
                 file->mode(Tfc::FileMode::READ);
-                std::vector<Tfc::TagRecord*> tags = file->listTags();
+                std::vector<Tfc::TagRecord*> tags = args.size() == 2 ? file->findTags(args[1]) : file->listTags();
 
                 // determine the longest tag name
                 unsigned long nameLength = 10; // default to 10 chars
@@ -295,12 +331,50 @@ int main(int argc, char** argv) {
                 printf(headerTemplate.c_str(), "----------", "----------");
 
                 // print tags
-                for(Tfc::TagRecord* tag : file->listTags())
+                for(Tfc::TagRecord* tag : tags)
                     printf(rowTemplate.c_str(), tag->getName().c_str(), tag->getBlobs()->size());
 
                 continue;
             }
 
+            // find command
+            if(args[0] == "find" && args.size() == 2) {
+                file->mode(Tfc::FileMode::READ);
+                std::vector<Tfc::BlobRecord*> blobs = file->findBlobsByName(args[1]);
+                if(blobs.empty()) {
+                    std::cout << status(ResultType::INFO) << "No files named " << args[1] << " are stashed\n";
+                    continue;
+                }
+                printBlobs(blobs);
+                continue;
+            }
+
+            // complete command
+            if(args[0] == "complete") {
+                const std::vector<std::string> COMMANDS = { "about", "clear", "complete", "compress", "dedup", "delete",
+                                                            "exit", "files", "find", "help", "init", "license",
+                                                            "search", "stash", "tag", "tags", "unstash" };
+
+                // the first word completes to a command
+                if(args.size() <= 2) {
+                    std::string word = args.size() == 2 ? args[1] : "";
+                    for(const std::string &command : COMMANDS) {
+                        if(command.compare(0, word.size(), word) == 0)
+                            std::cout << status(ResultType::OUTPUT) << command << "\n";
+                    }
+                    continue;
+                }
+
+                // later words complete to a tag, after any parentheses opening a group of a query
+                std::string word = args.back();
+                size_t start = std::min(word.find_first_not_of('('), word.size());
+                file->mode(Tfc::FileMode::READ);
+                for(Tfc::TagRecord* tag : file->findTags(word.substr(start) + "*"))
+                    std::cout << status(ResultType::OUTPUT) << word.substr(0, start) << tag->getName() << "\n";
+
+                continue;
+            }
+
             // stash command
             if (args[0] == "stash" && args.size() == 2) {
 
@@ -308,6 +382,34 @@ int main(int argc, char** argv) {
                 std::vector<std::string> path = split(args[1], '/');
                 std::string name = path[path.size() - 1];
 
+                // stash every file in a directory at once
+                struct stat info = {};
+                if (stat(args[1].c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+                    auto* stashTask = new Tasker::Task([&file, &args](Tasker::TaskHandle* handle) -> void* {
+                        auto* nonces = new std::vector<std::pair<std::string, uint32_t>>();
+                        *nonces = stashDirectory(file, args[1]);
+
+                        return static_cast<void*>(nonces);
+                    });
+
+                    // show animation while the files are stashed
+                    loop.run(stashTask);
+                    await(stashTask, "Stashing " + name);
+                    if (stashTask->getState() == Tasker::TaskState::FAILED)
+                        std::rethrow_exception(stashTask->getException());
+
+                    // extract the nonces
+                    auto* nonces = static_cast<std::vector<std::pair<std::string, uint32_t>>*>(stashTask->getResult());
+
+                    for (auto &nonce : *nonces)
+                        std::cout << status(ResultType::SUCCESS) << "Stashed " << nonce.first << " with ID "
+                                  << nonce.second << "\n";
+                    delete nonces;
+                    delete stashTask;
+
+                    continue;
+                }
+
                 // stash the file
                 auto* stashTask = new Tasker::Task([&file, &name, &args](Tasker::TaskHandle* handle) -> void* {
                     auto* nonce = new uint32_t();
@@ -340,15 +442,9 @@ int main(int argc, char** argv) {
 
                 // unstash the file
                 Tasker::Task* task = new Tasker::Task([&file, nonce, &args](Tasker::TaskHandle* handle) -> void* {
-                    auto* name = new std::string();
-
-                    if(args.size() == 2) { // use original filename
-                        Tfc::BlobRecord* result = unstash(file, static_cast<uint32_t>(nonce));
-                        *name = result->getName();
-                    } else { // use explicit filename
-                        unstash(file, static_cast<uint32_t>(nonce), args[2]);
-                        *name = args[2];
-                    }
+                    // use the original filename unless one is given
+                    auto* name = new std::string(unstash(file, static_cast<uint32_t>(nonce),
+                                                         args.size() == 3 ? args[2] : ""));
 
                     return static_cast<void*>(name);
                 });
@@ -386,9 +482,10 @@ int main(int argc, char** argv) {
                     return nullptr;
                 });
 
-                // wait for the task to complete
+                // wait for the task to complete, then commit the deletion and unlock the file for other processes
                 loop.run(task);
                 await(task, "Deleting file");
+                file->mode(Tfc::FileMode::READ);
                 if (task->getState() == Tasker::TaskState::FAILED)
                     std::rethrow_exception(task->getException());
 
@@ -405,13 +502,22 @@ int main(int argc, char** argv) {
                 if (nonce < 0)
                     throw Tfc::Exception("File IDs cannot be negative");
 
-                // attach the tags
+                // attach the tags in one transaction, so the tables are written once and a failure attaches none
                 file->mode(Tfc::FileMode::READ);
                 file->mode(Tfc::FileMode::EDIT);
-                for(int i = 2; i < args.size(); i++) {
-                    file->attachTag(static_cast<uint32_t>(nonce), args[i]);
-                    std::cout << status(ResultType::SUCCESS) << "Tagged " << nonce << " as " << args[i] << "\n";
+                file->begin();
+                try {
+                    for(int i = 2; i < args.size(); i++)
+                        file->attachTag(static_cast<uint32_t>(nonce), args[i]);
+                } catch (std::exception &ex) {
+                    file->rollback();
+                    file->mode(Tfc::FileMode::READ);
+                    throw Tfc::Exception(std::string(ex.what()) + ". No tags were attached");
                 }
+                file->commit();
+                file->mode(Tfc::FileMode::READ); // unlocks the file for other processes
+                for(int i = 2; i < args.size(); i++)
+                    std::cout << status(ResultType::SUCCESS) << "Tagged " << nonce << " as " << args[i] << "\n";
 
                 continue;
             }
@@ -419,18 +525,21 @@ int main(int argc, char** argv) {
             // search command
             if (args[0] == "search" && args.size() > 1) {
 
-                // build a set of tags
-                std::vector<std::string> tags;
-                for(int i = 1; i < args.size(); i++)
-                    tags.push_back(args[i]);
-
-                // get a set of intersecting blobs
-                std::vector<Tfc::BlobRecord*> intersection;
+                // parse the query, its words may be split across arguments
+                std::vector<std::string> words(args.begin() + 1, args.end());
                 file->mode(Tfc::FileMode::READ);
-                intersection = file->intersection(tags);
-
-                // print intersecting blobs
-                printBlobs(intersection);
+                Tfc::BlobQuery* query = file->query(join(words, " "));
+
+                // print the matching blobs as they are found
+                try {
+                    printBlobHeader();
+                    for(Tfc::BlobRecord* record = query->next(); record != nullptr; record = query->next())
+                        printBlob(record);
+                } catch (std::exception &ex) {
+                    delete query;
+                    throw;
+                }
+                delete query;
 
                 continue;
 
@@ -519,6 +628,35 @@ void await(Tasker::Task* task, const std::string &message) {
     std::cout << Terminal::Cursor::HOME << Terminal::Cursor::ERASE_EOL << std::flush;
 }
 
+/**
+ * Reads a file from the filesystem a chunk at a time and writes it to a blob writer, then commits the blob.
+ *
+ * @param writer The writer for the blob
+ * @param path The path of the file to read
+ * @return The ID that was assigned to the blob.
+ */
+uint32_t copyToWriter(Tfc::BlobWriter* writer, const std::string &path) {
+    const std::streamsize CHUNK_SIZE = 1048576; // number of bytes read from the file at a time
+
+    // open the file
+    std::ifstream stream;
+    stream.open(path, std::ios::binary | std::ios::in);
+    if(stream.fail())
+        throw Tfc::Exception("Failed to open file " + path + " for reading");
+
+    // pipe the file into the writer a chunk at a time
+    std::vector<char> chunk(CHUNK_SIZE);
+    while(stream) {
+        stream.read(chunk.data(), CHUNK_SIZE);
+        writer->append(chunk.data(), static_cast<uint64_t>(stream.gcount()));
+    }
+    if(!stream.eof())
+        throw Tfc::Exception("Failed to read file " + path);
+    stream.close();
+
+    return writer->commit();
+}
+
 /**
  * Prints help text
  */
@@ -536,14 +674,18 @@ void help() {
                    "\t%-25s\tclears the screen\n"
                    "\t%-25s\tcreates a new unencrypted container file\n"
                    "\t%-25s\tconfigures encryption on this container\n"
-                   "\t%-25s\tcopies a file into the container\n"
+                   "\t%-25s\tcopies a file, or each file in a directory, into the container\n"
+                   "\t%-25s\tcompresses files when they are stashed\n"
+                   "\t%-25s\tstores identical files only once when they are stashed\n"
                    "\t%-25s\tcopies a file out of the container\n"
                    "\t%-25s\tdeletes a file from the container\n"
                    "\t%-25s\tadds a tag to a file\n"
                    "\t%-25s\tremoves a tag from a file\n"
-                   "\t%-25s\tsearches for files matching the tags\n"
+                   "\t%-25s\tsearches for files matching a query of tags\n"
                    "\t%-25s\tlists all files with their ID and tags\n"
-                   "\t%-25s\tlists all tags by their name\n\n"
+                   "\t%-25s\tlists the files stashed with a name, or with a prefix before *\n"
+                   "\t%-25s\tlists all tags by their name, or those matching a pattern\n"
+                   "\t%-25s\tlists the commands or tags which complete the last word\n\n"
                    "Interactive Mode:\n"
                    "\tYou can start tfc in interactive mode by omitting commands in the \n"
                    "\tcommand line. Only the filename should be specified. Interactive mode \n"
@@ -554,10 +696,25 @@ void help() {
                    "\tYou can start tfc in non-interactive mode by passing command-line \n"
                    "\targuments to tfc. This can be useful when using tfc with scripting. \n"
                    "\tCommands can be run in non-interactive mode by prefixing the command \n"
-                   "\twith --. For example, `--stash cute-cat.png`.\n",
-           "--about", "--help", "--license", "--version", "help", "about", "license", "clear", "init",
-           "(TBI) key <key>", "stash <filename>", "unstash <id> [filename]", "delete <id>", "tag <id> <tag> ...",
-           "(TBI) untag <id> <tag>", "search <tag> ...", "files", "tags");
+                   "\twith --. For example, `--stash cute-cat.png`.\n\n"
+                   "Block Sizes:\n"
+                   "\tFiles are stored in whole blocks. The block size is chosen when the \n"
+                   "\tcontainer is created and may be given in bytes or with a k or m \n"
+                   "\tsuffix, from 512 to 1m. Larger blocks are faster for large files. \n"
+                   "\tThe default is 4k.\n\n"
+                   "Queries:\n"
+                   "\tA search query joins tags with AND, OR and NOT, which must be upper \n"
+                   "\tcase, and groups them with parentheses. Tags next to each other must \n"
+                   "\tall match. For example, `search (cat OR dog) AND NOT blurry`.\n\n"
+                   "Tag Patterns:\n"
+                   "\tIn a tag pattern, * matches any characters and ? matches any one \n"
+                   "\tcharacter, so `tags year:2019*` lists the tags starting with \n"
+                   "\tyear:2019. A pattern ending in ~ and an optional distance, such as \n"
+                   "\t`tags colour~2`, lists the tags within that many typos, up to 3.\n",
+           "--about", "--help", "--license", "--version", "help", "about", "license", "clear", "init [block size]",
+           "(TBI) key <key>", "stash <path>", "compress <on|off>", "dedup <on|chunks|off>", "unstash <id> [filename]",
+           "delete <id>", "tag <id> <tag> ...", "(TBI) untag <id> <tag>", "search <query>", "files", "find <name>",
+           "tags [pattern]", "complete <command>");
 }
 
 /**
@@ -660,69 +817,113 @@ std::vector<std::string> parseInput(const std::string &input) {
 }
 
 /**
- * Prints a list of blobs and their properties to stdout.
+ * Helper function. Parses a size in bytes. The size may be suffixed with k or m for kibibytes or mebibytes.
  *
- * @param blobs A vector of blobs to print.
+ * @param size The size string, such as 512, 4k or 1m.
+ * @return The size in bytes.
  */
-void printBlobs(const std::vector<Tfc::BlobRecord*> &blobs) {
-    const int ID_LEN       = 10; // length of the id column
-    const int HASH_LEN     = 16; // length of the hash column
-    const int TAGS_LEN     = 10; // length of the tag column header
-    const int MAX_LINE_LEN = 80; // maximum length of a line
+uint32_t parseSize(const std::string &size) {
+    std::string lower = size;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+    // determine the unit
+    uint64_t multiplier = 1;
+    if (!lower.empty() && (lower.back() == 'k' || lower.back() == 'm')) {
+        multiplier = lower.back() == 'k' ? 1024 : 1024 * 1024;
+        lower.pop_back();
+    }
 
-    // build template strings for printing
-    std::string headerTemplate = std::string("%-" + std::to_string(ID_LEN) + "s  %-" + std::to_string(HASH_LEN)
-                                             + "s  %-" + std::to_string(TAGS_LEN) + "s\n");
+    // parse the number
+    if (lower.empty() || lower.find_first_not_of("0123456789") != std::string::npos)
+        throw Tfc::Exception("Invalid size " + size);
+    uint64_t value = std::stoull(lower) * multiplier;
+    if (value > UINT32_MAX)
+        throw Tfc::Exception("Invalid size " + size);
 
-    // print info for the resultant blobs
-    unsigned long tagColStart = (ID_LEN + 2) + (HASH_LEN + 2); // start pos of the tag column
-    printf(std::string(status(ResultType::OUTPUT) + headerTemplate).c_str(), "ID", "Hash", "Tags");
-    printf(std::string(status(ResultType::OUTPUT) + headerTemplate).c_str(), "----------", "----------", "----------");
-    for (Tfc::BlobRecord* record : blobs) {
+    return static_cast<uint32_t>(value);
+}
 
-        // print nonce
-        printf("%s%-10d  ", status(ResultType::OUTPUT).c_str(), record->getNonce());
+/**
+ * Column widths of the printed blob list
+ */
+const int BLOB_ID_LEN       = 10; // length of the id column
+const int BLOB_HASH_LEN     = 16; // length of the hash column
+const int BLOB_TAGS_LEN     = 10; // length of the tag column header
+const int BLOB_MAX_LINE_LEN = 80; // maximum length of a line
 
-        // print hash as hex
-        printf("%llx  ", static_cast<unsigned long long>(record->getHash()));
+/**
+ * Prints a blob and its properties to stdout as a row of the blob list.
+ *
+ * @param record The blob to print.
+ */
+void printBlob(Tfc::BlobRecord* record) {
+    unsigned long tagColStart = (BLOB_ID_LEN + 2) + (BLOB_HASH_LEN + 2); // start pos of the tag column
 
-        // build vector of tag names
-        std::vector<std::string> tagNames;
-        for(auto tag : *record->getTags())
-            tagNames.push_back(tag->getName());
+    // print nonce
+    printf("%s%-10d  ", status(ResultType::OUTPUT).c_str(), record->getNonce());
 
-        // sort the tag names
-        std::sort(tagNames.begin(), tagNames.end());
+    // print hash as hex
+    printf("%llx  ", static_cast<unsigned long long>(record->getHash()));
 
-        // join and print tag names with proper line breaking
-        unsigned long lineLength = tagColStart;
-        for(unsigned long i = 0; i < tagNames.size(); i++) {
-            auto tag = tagNames[i];
+    // build vector of tag names
+    std::vector<std::string> tagNames;
+    for(auto tag : *record->getTags())
+        tagNames.push_back(tag->getName());
 
-            // build the line to be printed
-            std::string printTag = tag;
-            if(i + 1 < tagNames.size())
-                printTag += ", ";
+    // sort the tag names
+    std::sort(tagNames.begin(), tagNames.end());
 
-            // if line exceeds max length, break to next line
-            if(lineLength + printTag.length() > MAX_LINE_LEN) {
-                printf("%c%s", '\n', status(ResultType::OUTPUT).c_str());
-                lineLength = tagColStart;
+    // join and print tag names with proper line breaking
+    unsigned long lineLength = tagColStart;
+    for(unsigned long i = 0; i < tagNames.size(); i++) {
+        auto tag = tagNames[i];
 
-                // print spacing up to start of tag column
-                for(unsigned long j = 0; j < tagColStart; j++)
-                    printf("%c", ' ');
-            }
+        // build the line to be printed
+        std::string printTag = tag;
+        if(i + 1 < tagNames.size())
+            printTag += ", ";
 
-            // print tag
-            printf("%s", printTag.c_str());
-            lineLength += printTag.length();
+        // if line exceeds max length, break to next line
+        if(lineLength + printTag.length() > BLOB_MAX_LINE_LEN) {
+            printf("%c%s", '\n', status(ResultType::OUTPUT).c_str());
+            lineLength = tagColStart;
 
+            // print spacing up to start of tag column
+            for(unsigned long j = 0; j < tagColStart; j++)
+                printf("%c", ' ');
         }
-        printf("\n");
+
+        // print tag
+        printf("%s", printTag.c_str());
+        lineLength += printTag.length();
 
     }
+    printf("\n");
+
+}
+
+/**
+ * Prints the header of the blob list to stdout.
+ */
+void printBlobHeader() {
+
+    // build template strings for printing
+    std::string headerTemplate = std::string("%-" + std::to_string(BLOB_ID_LEN) + "s  %-" + std::to_string(BLOB_HASH_LEN)
+                                             + "s  %-" + std::to_string(BLOB_TAGS_LEN) + "s\n");
 
+    printf(std::string(status(ResultType::OUTPUT) + headerTemplate).c_str(), "ID", "Hash", "Tags");
+    printf(std::string(status(ResultType::OUTPUT) + headerTemplate).c_str(), "----------", "----------", "----------");
+}
+
+/**
+ * Prints a list of blobs and their properties to stdout.
+ *
+ * @param blobs A vector of blobs to print.
+ */
+void printBlobs(const std::vector<Tfc::BlobRecord*> &blobs) {
+    printBlobHeader();
+    for (Tfc::BlobRecord* record : blobs)
+        printBlob(record);
 }
 
 /**
@@ -750,32 +951,74 @@ std::vector<std::string> split(const std::string &string, char delim) {
  * @return The ID that was assigned to the stashed file.
  */
 uint32_t stash(Tfc::File* file, const std::string &filename, const std::string &path) {
+    file->mode(Tfc::FileMode::READ);
+    file->mode(Tfc::FileMode::EDIT);
 
-    // read in file
-    std::ifstream stream;
-    stream.open(path, std::ios::binary | std::ios::in | std::ios::ate);
-    if(stream.fail())
-        throw Tfc::Exception("Failed to open file " + path + " for reading");
+    // pipe the file into the container
+    uint32_t nonce;
+    Tfc::BlobWriter* writer = file->writer(filename);
+    try {
+        nonce = copyToWriter(writer, path);
+    } catch (std::exception &ex) {
+        delete writer;
+        throw;
+    }
+    delete writer;
+    file->mode(Tfc::FileMode::CLOSED);
 
-    // read stream size
-    std::streamsize size = stream.tellg();
-    stream.seekg(0, stream.beg);
+    return nonce;
+}
 
-    // read data
-    auto* data = new char[size];
-    stream.read(data, size);
-    stream.close();
+/**
+ * Reads every file in a directory from the filesystem and writes them to the container in one transaction, so the
+ * tables are only written once. If any file fails to stash, none of them are kept. Subdirectories are skipped.
+ *
+ * @param file The TFC file object
+ * @param path The path of the directory to stash
+ * @return The name of each stashed file with the ID that was assigned to it, ordered by name.
+ * @throw Tfc::Exception A file could not be stashed. The container is left as it was.
+ */
+std::vector<std::pair<std::string, uint32_t>> stashDirectory(Tfc::File* file, const std::string &path) {
+
+    // find the regular files in the directory
+    DIR* dir = opendir(path.c_str());
+    if(dir == nullptr)
+        throw Tfc::Exception("Failed to open directory " + path);
+    std::vector<std::string> names;
+    struct dirent* entry;
+    while((entry = readdir(dir)) != nullptr) {
+        struct stat info = {};
+        if(stat((path + "/" + entry->d_name).c_str(), &info) == 0 && S_ISREG(info.st_mode))
+            names.emplace_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
 
-    // add data as blob
+    // pipe each file into the container
     file->mode(Tfc::FileMode::READ);
     file->mode(Tfc::FileMode::EDIT);
-    uint32_t nonce = file->addBlob(filename, data, static_cast<uint64_t>(size));
+    std::vector<std::pair<std::string, uint32_t>> nonces;
+    file->begin();
+    try {
+        for(const std::string &name : names) {
+            Tfc::BlobWriter* writer = file->writer(name);
+            try {
+                nonces.emplace_back(name, copyToWriter(writer, path + "/" + name));
+            } catch (std::exception &ex) {
+                delete writer; // aborts the file which was being stashed
+                throw;
+            }
+            delete writer;
+        }
+    } catch (std::exception &ex) {
+        file->rollback();
+        file->mode(Tfc::FileMode::CLOSED);
+        throw Tfc::Exception(std::string(ex.what()) + ". No files were stashed");
+    }
+    file->commit();
     file->mode(Tfc::FileMode::CLOSED);
 
-    // clean up
-    delete [] data;
-
-    return nonce;
+    return nonces;
 }
 
 /**
@@ -816,35 +1059,41 @@ std::string status(ResultType resultType) {
  * @param id The ID of the file to unstash
  * @param filename The name the file should be given when it is written to the filesystem. Original name if not
  *                 specified.
+ * @return The name the file was written to. The blob's record isn't returned, since the container is closed by then.
  */
-Tfc::BlobRecord* unstash(Tfc::File* file, uint32_t id, const std::string &filename) {
-    Tfc::BlobRecord* record;
+std::string unstash(Tfc::File* file, uint32_t id, const std::string &filename) {
+    const uint64_t CHUNK_SIZE = 1048576; // number of bytes written to the file at a time
 
-    // read the blob from the container
+    // open the blob in the container
     file->mode(Tfc::FileMode::READ);
-    Tfc::Blob* blob = file->readBlob(id);
-    file->mode(Tfc::FileMode::CLOSED);
-    if(blob == nullptr)
-        throw Tfc::Exception("No file with that ID exists");
-    record = blob->record;
+    Tfc::BlobReader* reader = file->reader(id);
 
     // determine the filename
     std::string blobFilename;
     if(filename.empty())
-        blobFilename = blob->record->getName();
+        blobFilename = reader->getRecord()->getName();
     else
         blobFilename = filename;
 
-    // open the file for writing
-    std::ofstream stream(blobFilename.c_str(), std::ios::out | std::ios::binary);
-    if(stream.fail())
-        throw Tfc::Exception("Failed to open file " + blobFilename + " for writing");
-    stream.write(blob->data, blob->record->getSize());
-    stream.close();
-
-    // clean up
-    delete [] blob->data;
-    delete blob;
+    // pipe the blob into the file a chunk at a time
+    std::vector<char> chunk(CHUNK_SIZE);
+    try {
+        std::ofstream stream(blobFilename.c_str(), std::ios::out | std::ios::binary);
+        if(stream.fail())
+            throw Tfc::Exception("Failed to open file " + blobFilename + " for writing");
+        uint64_t count;
+        while((count = reader->read(chunk.data(), CHUNK_SIZE)) > 0) {
+            stream.write(chunk.data(), static_cast<std::streamsize>(count));
+            if(stream.fail())
+                throw Tfc::Exception("Failed to write file " + blobFilename);
+        }
+        stream.close();
+    } catch (std::exception &ex) {
+        delete reader;
+        throw;
+    }
+    delete reader;
+    file->mode(Tfc::FileMode::CLOSED);
 
-    return record;
+    return blobFilename;
 }
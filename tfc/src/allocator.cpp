@@ -0,0 +1,266 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <iterator>
+#include <tfc/allocator.h>
+#include <tfc/exception.h>
+
+using namespace Tfc;
+
+/**
+ * Creates a new in-memory index of the free blocks in a block list. Every block starts out free; blocks which are in
+ * use should be marked with use().
+ *
+ * @param blockCount The number of blocks in the block list.
+ */
+BlockAllocator::BlockAllocator(uint32_t blockCount) {
+    this->blockCount = blockCount;
+    if(blockCount > 0) {
+        this->add(0, blockCount);
+        this->freeCount = blockCount;
+    }
+}
+
+/**
+ * Allocates a contiguous run of blocks. The smallest free extent which can hold the whole run is chosen. If there is
+ * none, a free extent at the end of the block list is grown to fit the run. Otherwise, the largest free extent is
+ * returned and the caller must allocate the rest of its blocks with another call. If there are no free blocks at all,
+ * the block list is grown by the whole run.
+ *
+ * @param count The number of blocks wanted.
+ * @return The allocated extent. Its length may be less than count, but never 0 unless count is 0.
+ */
+Extent BlockAllocator::allocate(uint32_t count) {
+
+    // nothing fits the whole run and the block list can't be grown in place, take the largest free extent
+    if(!this->extents.empty() && this->sizes.lower_bound({ count, 0 }) == this->sizes.end()) {
+        auto last = std::prev(this->extents.end());
+        if(last->first + last->second != this->blockCount) {
+            auto largest = std::prev(this->sizes.end());
+            Extent extent = { largest->second, largest->first };
+            this->use(extent.start, extent.length);
+            return extent;
+        }
+    }
+
+    return this->allocateRun(count);
+}
+
+/**
+ * Allocates a contiguous run of blocks which is never split. The smallest free extent which can hold the whole run is
+ * chosen. If there is none, the block list is grown to fit the run, starting from the free extent at the end of the
+ * block list if there is one.
+ *
+ * @param count The number of blocks wanted.
+ * @return The allocated extent. Its length is always count.
+ * @throw Exception The block list would grow past the largest block index.
+ */
+Extent BlockAllocator::allocateRun(uint32_t count) {
+    Extent extent = { 0, 0 };
+    if(count == 0)
+        return extent;
+
+    // find the smallest free extent that will fit the whole run
+    auto fit = this->sizes.lower_bound({ count, 0 });
+    if(fit != this->sizes.end()) {
+        extent = { fit->second, count };
+        this->use(extent.start, count);
+        return extent;
+    }
+
+    // the last free extent is at the end of the block list, so the block list can be grown to fit the run
+    if(!this->extents.empty()) {
+        auto last = std::prev(this->extents.end());
+        if(last->first + last->second == this->blockCount) {
+            extent = { last->first, count };
+            this->growBy(count - last->second);
+            this->freeCount -= last->second;
+            this->remove(last);
+            return extent;
+        }
+    }
+
+    // grow the block list by the whole run
+    extent = { this->blockCount, count };
+    this->growBy(count);
+    return extent;
+}
+
+/**
+ * Grows an allocated run of blocks in place by taking the free blocks directly after it. If the run reaches the end
+ * of the block list, the block list is grown.
+ *
+ * @param extent The allocated run of blocks.
+ * @param count The number of blocks wanted.
+ * @return The number of blocks the run was grown by, which may be less than count.
+ * @throw Exception The block list would grow past the largest block index.
+ */
+uint32_t BlockAllocator::extend(const Extent &extent, uint32_t count) {
+    uint32_t end = extent.start + extent.length;
+
+    // the run is at the end of the block list, grow the block list
+    if(end == this->blockCount) {
+        this->growBy(count);
+        return count;
+    }
+
+    // the block after the run must be the start of a free extent
+    auto next = this->extents.find(end);
+    if(next == this->extents.end())
+        return 0;
+
+    // the free extent is at the end of the block list, take all of it and grow the block list for the rest
+    uint32_t length = next->second;
+    if(length < count && end + length == this->blockCount) {
+        this->growBy(count - length);
+        this->use(end, length);
+        return count;
+    }
+
+    // take as much of the free extent as is needed
+    uint32_t added = std::min(count, length);
+    this->use(end, added);
+    return added;
+}
+
+/**
+ * Marks a range of blocks as free, merging it with any free extents it overlaps or touches. Blocks in the range which
+ * are already free are only counted once.
+ *
+ * @param block The index of the first block in the range.
+ * @param count The number of blocks in the range.
+ * @throw Exception The range runs past the end of the block list.
+ */
+void BlockAllocator::free(uint32_t block, uint32_t count) {
+    if(count == 0)
+        return;
+    if(block > this->blockCount || count > this->blockCount - block)
+        throw Exception("Blocks past the end of the block list can't be freed");
+
+    uint32_t end = block + count;
+    uint32_t start = block;
+    uint32_t stop = end;
+    uint32_t freed = count;
+
+    // start at the extent which may contain or end at the first block
+    auto iter = this->extents.upper_bound(block);
+    if(iter != this->extents.begin() && std::prev(iter)->first + std::prev(iter)->second >= block)
+        iter = std::prev(iter);
+
+    // merge every free extent which overlaps or touches the range, without counting its blocks twice
+    while(iter != this->extents.end() && iter->first <= end) {
+        uint32_t extentStart = iter->first;
+        uint32_t extentStop = iter->first + iter->second;
+        if(extentStop > block && extentStart < end)
+            freed -= std::min(extentStop, end) - std::max(extentStart, block);
+        start = std::min(start, extentStart);
+        stop = std::max(stop, extentStop);
+        iter = this->remove(iter);
+    }
+
+    this->add(start, stop - start);
+    this->freeCount += freed;
+}
+
+/**
+ * Grows the block list to a number of blocks. The new blocks are free.
+ *
+ * @param blockCount The new number of blocks in the block list. Nothing is done if it is not larger than the current
+ *                   number of blocks.
+ */
+void BlockAllocator::grow(uint32_t blockCount) {
+    if(blockCount <= this->blockCount)
+        return;
+    uint32_t start = this->blockCount;
+    this->blockCount = blockCount;
+    this->free(start, blockCount - start);
+}
+
+/**
+ * Marks a range of blocks as in use. Blocks in the range which are already in use are left alone.
+ *
+ * @param block The index of the first block in the range.
+ * @param count The number of blocks in the range.
+ * @throw Exception The range runs past the largest block index.
+ */
+void BlockAllocator::use(uint32_t block, uint32_t count) {
+    if(count > UINT32_MAX - block)
+        throw Exception("Block range runs past the largest block index");
+    uint32_t end = block + count;
+
+    // start at the extent which may contain the first block
+    auto iter = this->extents.upper_bound(block);
+    if(iter != this->extents.begin())
+        iter = std::prev(iter);
+
+    // split every free extent which overlaps the range
+    while(iter != this->extents.end() && iter->first < end) {
+        uint32_t start = iter->first;
+        uint32_t stop = iter->first + iter->second;
+        if(stop <= block) { // extent ends before the range
+            iter++;
+            continue;
+        }
+        iter = this->remove(iter);
+
+        // count the blocks which were taken
+        this->freeCount -= std::min(stop, end) - std::max(start, block);
+
+        // keep the parts of the extent outside of the range
+        if(start < block)
+            this->add(start, block - start);
+        if(stop > end) {
+            this->add(end, stop - end);
+            break;
+        }
+    }
+}
+
+/**
+ * Adds a free extent to both indexes. The extent must not overlap or touch any other free extent.
+ *
+ * @param block The index of the first block in the extent.
+ * @param count The number of blocks in the extent.
+ */
+void BlockAllocator::add(uint32_t block, uint32_t count) {
+    this->extents.insert({ block, count });
+    this->sizes.insert({ count, block });
+}
+
+/**
+ * Grows the block list by a number of blocks which are in use.
+ *
+ * @param count The number of blocks to add.
+ * @throw Exception The block list would grow past the largest block index.
+ */
+void BlockAllocator::growBy(uint32_t count) {
+    if(count > UINT32_MAX - this->blockCount)
+        throw Exception("Block list can't grow past " + std::to_string(UINT32_MAX) + " blocks");
+    this->blockCount += count;
+}
+
+/**
+ * Removes a free extent from both indexes.
+ *
+ * @param extent An iterator to the extent.
+ * @return An iterator to the next extent.
+ */
+std::map<uint32_t, uint32_t>::iterator BlockAllocator::remove(std::map<uint32_t, uint32_t>::iterator extent) {
+    this->sizes.erase({ extent->second, extent->first });
+    return this->extents.erase(extent);
+}
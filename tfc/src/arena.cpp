@@ -0,0 +1,98 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <tfc/arena.h>
+
+using namespace Tfc;
+
+const size_t Arena::BLOCK_SIZE;
+const size_t Arena::LARGE_SIZE;
+
+/**
+ * Frees the arena's blocks.
+ */
+Arena::~Arena() {
+    this->reset();
+    for(char* block : this->blocks)
+        delete [] block;
+}
+
+/**
+ * Allocates memory from the arena. The memory is only reclaimed when the arena is reset. Large allocations get a
+ * block of their own, so they don't leave the rest of a block unused.
+ *
+ * @param size The number of bytes.
+ * @param alignment The alignment of the memory, a power of two no larger than that of any scalar type.
+ * @return The memory.
+ */
+void* Arena::allocate(size_t size, size_t alignment) {
+    if(size > LARGE_SIZE) {
+        this->largeBlocks.push_back(new char[size]);
+        this->largeSize += size;
+        return this->largeBlocks.back();
+    }
+
+    // align the offset in the current block, moving on to the next block if it doesn't fit
+    size_t start = (this->offset + alignment - 1) & ~(alignment - 1);
+    if(this->blocks.empty() || start + size > BLOCK_SIZE) {
+        if(!this->blocks.empty())
+            this->block++;
+        if(this->block == this->blocks.size())
+            this->blocks.push_back(new char[BLOCK_SIZE]);
+        start = 0;
+    }
+    this->offset = start + size;
+    return this->blocks[this->block] + start;
+}
+
+/**
+ * Records that memory handed out by the arena is no longer in use. The memory isn't reclaimed until the arena is reset,
+ * but the total tells the owner when resetting it and building its objects again would be worthwhile.
+ *
+ * @param size The number of bytes.
+ */
+void Arena::discard(size_t size) {
+    this->wasted += size;
+}
+
+/**
+ * Returns the number of bytes the arena has taken from the heap.
+ */
+uint64_t Arena::getCapacity() {
+    return static_cast<uint64_t>(this->blocks.size()) * BLOCK_SIZE + this->largeSize;
+}
+
+/**
+ * Returns the number of bytes handed out since the arena was last reset, including those which have been discarded.
+ */
+uint64_t Arena::getUsed() {
+    return static_cast<uint64_t>(this->block) * BLOCK_SIZE + this->offset + this->largeSize;
+}
+
+/**
+ * Makes all of the arena's memory available again. The objects in it are trivially destructible, so nothing is
+ * destroyed. The blocks are kept for reuse, apart from those of large allocations.
+ */
+void Arena::reset() {
+    for(char* block : this->largeBlocks)
+        delete [] block;
+    this->largeBlocks.clear();
+    this->largeSize = 0;
+    this->wasted = 0;
+    this->block = 0;
+    this->offset = 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <tfc/batch.h>
+#include <tfc/file.h>
+
+using namespace Tfc;
+
+/**
+ * Creates a new batch of mutations. Use File::batch() to open one.
+ *
+ * @param file The file the batch applies to.
+ */
+WriteBatch::WriteBatch(File* file) {
+    this->file = file;
+}
+
+/**
+ * Destroys the batch. If the batch was not committed, it is committed now, since its mutations have already been made.
+ */
+WriteBatch::~WriteBatch() {
+    if(!this->done) {
+        try {
+            this->commit();
+        } catch(Exception &ex) {
+            // the tables will be written by the next mutation or mode switch
+        }
+    }
+}
+
+/**
+ * EDIT operation. Adds a blob to the container as part of the batch.
+ *
+ * @param name The display name of the blob.
+ * @param bytes Pointer to the raw bytes of the blob.
+ * @param size The size of the blob in bytes.
+ * @return The container index that was assigned to the blob.
+ */
+uint32_t WriteBatch::addBlob(const std::string &name, char* bytes, uint64_t size) {
+    this->check();
+    return this->file->addBlob(name, bytes, size);
+}
+
+/**
+ * EDIT operation. Attaches a tag to a blob as part of the batch. If the tag does not exist, it will be created.
+ *
+ * @param nonce The nonce of the blob to which the tag will be attached.
+ * @param tag The string tag to be attached. Tags are case insensitive.
+ */
+void WriteBatch::attachTag(uint32_t nonce, const std::string &tag) {
+    this->check();
+    this->file->attachTag(nonce, tag);
+}
+
+/**
+ * EDIT operation. Writes the changes to the tables made by every mutation in the batch in one go.
+ */
+void WriteBatch::commit() {
+    this->check();
+    this->done = true;
+    this->file->endBatch();
+}
+
+/**
+ * EDIT operation. Deletes a blob as part of the batch.
+ *
+ * @param nonce The nonce of the blob that will be deleted.
+ */
+void WriteBatch::deleteBlob(uint32_t nonce) {
+    this->check();
+    this->file->deleteBlob(nonce);
+}
+
+/**
+ * EDIT operation. Opens a writer for adding a blob a piece at a time as part of the batch. The blob joins the batch
+ * when the writer is committed. The caller owns the writer and must delete it.
+ *
+ * @param name The display name of the blob.
+ * @return A writer for the blob.
+ */
+BlobWriter* WriteBatch::writer(const std::string &name) {
+    this->check();
+    return this->file->writer(name);
+}
+
+/**
+ * Checks that the batch can still be added to.
+ *
+ * @throw Exception The batch was already committed.
+ */
+void WriteBatch::check() {
+    if(this->done)
+        throw Exception("Batch has already been committed");
+}
@@ -0,0 +1,628 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <tfc/bitmap.h>
+#include <tfc/buffer.h>
+#include <tfc/cursor.h>
+#include <tfc/exception.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace Tfc;
+
+const uint32_t Bitmap::MAX_ARRAY_SIZE;
+const uint32_t Bitmap::BITSET_WORDS;
+
+/**
+ * Adds a value to the set. Adding a value which is already in the set does nothing.
+ *
+ * @param value The value.
+ */
+void Bitmap::add(uint32_t value) {
+    auto key = static_cast<uint16_t>(value >> 16);
+    auto low = static_cast<uint16_t>(value & 0xFFFF);
+
+    // find the value's container, or make one
+    auto container = this->find(key);
+    if(container == this->containers.end() || container->key != key) {
+        container = this->containers.insert(container, Container());
+        container->key = key;
+    }
+
+    if(!container->bits.empty()) {
+        uint64_t &word = container->bits[low >> 6];
+        uint64_t bit = 1ULL << (low & 63);
+        if((word & bit) == 0) {
+            word |= bit;
+            container->cardinality++;
+        }
+        return;
+    }
+
+    // values are usually added in ascending order, so they can just be appended
+    std::vector<uint16_t> &array = container->array;
+    if(array.empty() || array.back() < low) {
+        array.push_back(low);
+    } else {
+        auto iter = std::lower_bound(array.begin(), array.end(), low);
+        if(*iter == low)
+            return;
+        array.insert(iter, low);
+    }
+    container->cardinality++;
+    normalize(*container);
+}
+
+/**
+ * Whether a value is in the set.
+ *
+ * @param value The value.
+ */
+bool Bitmap::contains(uint32_t value) const {
+    auto key = static_cast<uint16_t>(value >> 16);
+    auto low = static_cast<uint16_t>(value & 0xFFFF);
+    auto container = this->find(key);
+    if(container == this->containers.end() || container->key != key)
+        return false;
+    if(!container->bits.empty())
+        return (container->bits[low >> 6] >> (low & 63) & 1) != 0;
+    return std::binary_search(container->array.begin(), container->array.end(), low);
+}
+
+/**
+ * Replaces the set with one read in the format written by encode().
+ *
+ * @param cursor Cursor positioned at the start of the set.
+ * @throw Exception The set is truncated or corrupt.
+ */
+void Bitmap::decode(Cursor &cursor) {
+    this->containers.clear();
+    uint32_t count = cursor.readUInt32();
+    if(count > 65536)
+        throw Exception("Corrupt bitmap");
+    this->containers.resize(count);
+    for(uint32_t i = 0; i < count; i++) {
+        Container &container = this->containers[i];
+        container.key = cursor.readUInt16();
+        container.cardinality = cursor.readUInt32();
+        if((i > 0 && container.key <= this->containers[i - 1].key) || container.cardinality == 0 ||
+           container.cardinality > 65536)
+            throw Exception("Corrupt bitmap");
+
+        // sparse containers are stored as the sorted values, dense ones as the bitset
+        if(container.cardinality <= MAX_ARRAY_SIZE) {
+            container.array.resize(container.cardinality);
+            for(uint16_t &value : container.array)
+                value = cursor.readUInt16();
+            if(std::adjacent_find(container.array.begin(), container.array.end(),
+                                  std::greater_equal<uint16_t>()) != container.array.end())
+                throw Exception("Corrupt bitmap");
+        } else {
+            container.bits.resize(BITSET_WORDS);
+            for(uint64_t &word : container.bits)
+                word = cursor.readUInt64();
+            if(countBits(container.bits.data()) != container.cardinality)
+                throw Exception("Corrupt bitmap");
+        }
+    }
+}
+
+/**
+ * Writes the set as the number of containers, then each container's key, number of values, and either its values, if
+ * there are no more than MAX_ARRAY_SIZE of them, or its bitset.
+ *
+ * @param buffer The buffer to write the set to.
+ */
+void Bitmap::encode(Buffer &buffer) const {
+    buffer.writeUInt32(static_cast<uint32_t>(this->containers.size()));
+    for(const Container &container : this->containers) {
+        buffer.writeUInt16(container.key);
+        buffer.writeUInt32(container.cardinality);
+        if(container.bits.empty()) {
+            for(uint16_t value : container.array)
+                buffer.writeUInt16(value);
+        } else {
+            for(uint64_t word : container.bits)
+                buffer.writeUInt64(word);
+        }
+    }
+}
+
+/**
+ * Removes the values which aren't in another set.
+ *
+ * @param other The other set.
+ */
+void Bitmap::intersect(const Bitmap &other) {
+    std::vector<Container> result;
+    auto iter = other.containers.begin();
+    for(Container &container : this->containers) {
+        while(iter != other.containers.end() && iter->key < container.key)
+            iter++;
+        if(iter == other.containers.end())
+            break;
+        if(iter->key != container.key)
+            continue;
+        andContainer(container, *iter);
+        if(container.cardinality > 0)
+            result.push_back(std::move(container));
+    }
+    this->containers.swap(result);
+}
+
+/**
+ * Finds the smallest value in the set which is at least a given value, so that the set can be walked in order from any
+ * point without copying it out.
+ *
+ * @param from The smallest value to find.
+ * @param value Set to the value which was found.
+ * @return Whether a value was found.
+ */
+bool Bitmap::next(uint32_t from, uint32_t &value) const {
+    auto key = static_cast<uint16_t>(from >> 16);
+    auto low = static_cast<uint16_t>(from & 0xFFFF);
+    for(auto container = this->find(key); container != this->containers.end(); container++) {
+        uint32_t high = static_cast<uint32_t>(container->key) << 16;
+
+        // every value of a later container is large enough
+        if(container->key != key)
+            low = 0;
+
+        if(container->bits.empty()) {
+            auto iter = std::lower_bound(container->array.begin(), container->array.end(), low);
+            if(iter != container->array.end()) {
+                value = high | *iter;
+                return true;
+            }
+            continue;
+        }
+
+        // walk the words from the one holding low, ignoring the bits below it
+        uint32_t i = low >> 6;
+        uint64_t word = container->bits[i] & (~0ULL << (low & 63));
+        while(word == 0 && ++i < BITSET_WORDS)
+            word = container->bits[i];
+        if(word != 0) {
+            value = high | (i << 6) | static_cast<uint32_t>(__builtin_ctzll(word));
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Finds the smallest value which is at least a given value and isn't in the set. Runs of values in the set are jumped
+ * over a container, a word of a bitset or a binary search of an array at a time, rather than a value at a time.
+ *
+ * @param from The smallest value to find.
+ * @param value Set to the value which was found.
+ * @return Whether a value was found. There is none if the set holds every value from the given one up.
+ */
+bool Bitmap::nextAbsent(uint32_t from, uint32_t &value) const {
+    auto key = static_cast<uint16_t>(from >> 16);
+    uint32_t low = from & 0xFFFF;
+    for(auto container = this->find(key); ; container++) {
+
+        // a value whose container is missing isn't in the set
+        if(container == this->containers.end() || container->key != key) {
+            value = (static_cast<uint32_t>(key) << 16) | low;
+            return true;
+        }
+
+        if(container->bits.empty()) {
+
+            // the values from low on are a run as long as each is its index plus the same offset, which stays true up
+            // to some index since the values are ascending and distinct
+            auto iter = std::lower_bound(container->array.begin(), container->array.end(), low);
+            if(iter == container->array.end() || *iter != low) {
+                value = (static_cast<uint32_t>(key) << 16) | low;
+                return true;
+            }
+            auto first = static_cast<size_t>(iter - container->array.begin());
+            int32_t offset = static_cast<int32_t>(*iter) - static_cast<int32_t>(first);
+            size_t lower = first;
+            size_t upper = container->array.size();
+            while(lower < upper) {
+                size_t middle = lower + (upper - lower) / 2;
+                if(static_cast<int32_t>(container->array[middle]) - static_cast<int32_t>(middle) == offset)
+                    lower = middle + 1;
+                else
+                    upper = middle;
+            }
+            low = static_cast<uint32_t>(container->array[lower - 1]) + 1;
+        } else {
+
+            // walk the words from the one holding low, looking for a clear bit at or above it
+            uint32_t i = low >> 6;
+            uint64_t word = ~container->bits[i] & (~0ULL << (low & 63));
+            while(word == 0 && ++i < BITSET_WORDS)
+                word = ~container->bits[i];
+            low = word != 0 ? (i << 6) | static_cast<uint32_t>(__builtin_ctzll(word)) : 0x10000;
+        }
+
+        // the run ends inside of this container
+        if(low < 0x10000) {
+            value = (static_cast<uint32_t>(key) << 16) | low;
+            return true;
+        }
+
+        // the run reaches the end of this container and carries on into the next key
+        if(key == 0xFFFF)
+            return false;
+        key++;
+        low = 0;
+    }
+}
+
+/**
+ * Removes a value from the set.
+ *
+ * @param value The value.
+ * @return Whether the value was in the set.
+ */
+bool Bitmap::remove(uint32_t value) {
+    auto key = static_cast<uint16_t>(value >> 16);
+    auto low = static_cast<uint16_t>(value & 0xFFFF);
+    auto container = this->find(key);
+    if(container == this->containers.end() || container->key != key)
+        return false;
+
+    if(!container->bits.empty()) {
+        uint64_t &word = container->bits[low >> 6];
+        uint64_t bit = 1ULL << (low & 63);
+        if((word & bit) == 0)
+            return false;
+        word &= ~bit;
+    } else {
+        auto iter = std::lower_bound(container->array.begin(), container->array.end(), low);
+        if(iter == container->array.end() || *iter != low)
+            return false;
+        container->array.erase(iter);
+    }
+
+    // drop the container once it's empty
+    if(--container->cardinality == 0)
+        this->containers.erase(container);
+    else
+        normalize(*container);
+    return true;
+}
+
+/**
+ * Returns the number of values in the set.
+ */
+uint64_t Bitmap::size() const {
+    uint64_t size = 0;
+    for(const Container &container : this->containers)
+        size += container.cardinality;
+    return size;
+}
+
+/**
+ * Removes the values which are in another set.
+ *
+ * @param other The other set.
+ */
+void Bitmap::subtract(const Bitmap &other) {
+    std::vector<Container> result;
+    auto iter = other.containers.begin();
+    for(Container &container : this->containers) {
+        while(iter != other.containers.end() && iter->key < container.key)
+            iter++;
+        if(iter != other.containers.end() && iter->key == container.key)
+            andNotContainer(container, *iter);
+        if(container.cardinality > 0)
+            result.push_back(std::move(container));
+    }
+    this->containers.swap(result);
+}
+
+/**
+ * Adds the values which are in another set.
+ *
+ * @param other The other set.
+ */
+void Bitmap::unite(const Bitmap &other) {
+    std::vector<Container> result;
+    result.reserve(std::max(this->containers.size(), other.containers.size()));
+    auto iter = this->containers.begin();
+    auto otherIter = other.containers.begin();
+    while(iter != this->containers.end() || otherIter != other.containers.end()) {
+        if(otherIter == other.containers.end() || (iter != this->containers.end() && iter->key < otherIter->key)) {
+            result.push_back(std::move(*iter++));
+        } else if(iter == this->containers.end() || otherIter->key < iter->key) {
+            result.push_back(*otherIter++);
+        } else {
+            orContainer(*iter, *otherIter++);
+            result.push_back(std::move(*iter++));
+        }
+    }
+    this->containers.swap(result);
+}
+
+/**
+ * Returns the values in the set in ascending order.
+ */
+std::vector<uint32_t> Bitmap::values() const {
+    std::vector<uint32_t> values;
+    values.reserve(this->size());
+    for(const Container &container : this->containers) {
+        uint32_t high = static_cast<uint32_t>(container.key) << 16;
+        if(container.bits.empty()) {
+            for(uint16_t low : container.array)
+                values.push_back(high | low);
+            continue;
+        }
+
+        // walk the set bits of each word
+        for(uint32_t i = 0; i < BITSET_WORDS; i++) {
+            uint64_t word = container.bits[i];
+            while(word != 0) {
+                values.push_back(high | (i << 6) | static_cast<uint32_t>(__builtin_ctzll(word)));
+                word &= word - 1;
+            }
+        }
+    }
+    return values;
+}
+
+/**
+ * Finds the container for a key, or the position at which it would be inserted.
+ *
+ * @param key The upper 16 bits of the values.
+ */
+std::vector<Bitmap::Container>::iterator Bitmap::find(uint16_t key) {
+    return std::lower_bound(this->containers.begin(), this->containers.end(), key,
+                            [](const Container &container, uint16_t key) { return container.key < key; });
+}
+
+std::vector<Bitmap::Container>::const_iterator Bitmap::find(uint16_t key) const {
+    return std::lower_bound(this->containers.begin(), this->containers.end(), key,
+                            [](const Container &container, uint16_t key) { return container.key < key; });
+}
+
+/**
+ * Removes the values of a container which aren't in another container with the same key.
+ *
+ * @param container The container.
+ * @param other The other container.
+ */
+void Bitmap::andContainer(Container &container, const Container &other) {
+    if(!container.bits.empty() && !other.bits.empty()) {
+        container.cardinality = andWords(container.bits.data(), other.bits.data());
+    } else if(!container.bits.empty()) {
+
+        // only the array's values can be left, so the result is an array
+        std::vector<uint16_t> array;
+        array.reserve(other.array.size());
+        for(uint16_t low : other.array) {
+            if((container.bits[low >> 6] >> (low & 63) & 1) != 0)
+                array.push_back(low);
+        }
+        container.bits.clear();
+        container.array.swap(array);
+        container.cardinality = static_cast<uint32_t>(container.array.size());
+    } else {
+        auto end = container.array.begin();
+        if(!other.bits.empty()) {
+            end = std::remove_if(container.array.begin(), container.array.end(), [&other](uint16_t low) {
+                return (other.bits[low >> 6] >> (low & 63) & 1) == 0;
+            });
+        } else {
+            end = std::set_intersection(container.array.begin(), container.array.end(), other.array.begin(),
+                                        other.array.end(), container.array.begin());
+        }
+        container.array.erase(end, container.array.end());
+        container.cardinality = static_cast<uint32_t>(container.array.size());
+    }
+    normalize(container);
+}
+
+/**
+ * Removes the values of a container which are in another container with the same key.
+ *
+ * @param container The container.
+ * @param other The other container.
+ */
+void Bitmap::andNotContainer(Container &container, const Container &other) {
+    if(!container.bits.empty() && !other.bits.empty()) {
+        container.cardinality = andNotWords(container.bits.data(), other.bits.data());
+    } else if(!container.bits.empty()) {
+        for(uint16_t low : other.array) {
+            uint64_t &word = container.bits[low >> 6];
+            uint64_t bit = 1ULL << (low & 63);
+            if((word & bit) != 0) {
+                word &= ~bit;
+                container.cardinality--;
+            }
+        }
+    } else {
+        auto end = container.array.begin();
+        if(!other.bits.empty()) {
+            end = std::remove_if(container.array.begin(), container.array.end(), [&other](uint16_t low) {
+                return (other.bits[low >> 6] >> (low & 63) & 1) != 0;
+            });
+        } else {
+            end = std::set_difference(container.array.begin(), container.array.end(), other.array.begin(),
+                                      other.array.end(), container.array.begin());
+        }
+        container.array.erase(end, container.array.end());
+        container.cardinality = static_cast<uint32_t>(container.array.size());
+    }
+    normalize(container);
+}
+
+/**
+ * Adds the values of another container with the same key to a container.
+ *
+ * @param container The container.
+ * @param other The other container.
+ */
+void Bitmap::orContainer(Container &container, const Container &other) {
+    if(container.bits.empty() && other.bits.empty()) {
+        std::vector<uint16_t> array;
+        array.reserve(container.array.size() + other.array.size());
+        std::set_union(container.array.begin(), container.array.end(), other.array.begin(), other.array.end(),
+                       std::back_inserter(array));
+        container.array.swap(array);
+        container.cardinality = static_cast<uint32_t>(container.array.size());
+        normalize(container);
+        return;
+    }
+
+    // the result is dense enough for a bitset
+    toBitset(container);
+    if(!other.bits.empty()) {
+        container.cardinality = orWords(container.bits.data(), other.bits.data());
+        return;
+    }
+    for(uint16_t low : other.array) {
+        uint64_t &word = container.bits[low >> 6];
+        uint64_t bit = 1ULL << (low & 63);
+        if((word & bit) == 0) {
+            word |= bit;
+            container.cardinality++;
+        }
+    }
+}
+
+/**
+ * Switches a container between an array and a bitset if its number of values calls for it.
+ *
+ * @param container The container.
+ */
+void Bitmap::normalize(Container &container) {
+    if(container.bits.empty() && container.cardinality > MAX_ARRAY_SIZE)
+        toBitset(container);
+    else if(!container.bits.empty() && container.cardinality <= MAX_ARRAY_SIZE)
+        toArray(container);
+}
+
+/**
+ * Converts a bitset container to an array container.
+ *
+ * @param container The container.
+ */
+void Bitmap::toArray(Container &container) {
+    if(container.bits.empty())
+        return;
+    container.array.clear();
+    container.array.reserve(container.cardinality);
+    for(uint32_t i = 0; i < BITSET_WORDS; i++) {
+        uint64_t word = container.bits[i];
+        while(word != 0) {
+            container.array.push_back(static_cast<uint16_t>((i << 6) | static_cast<uint32_t>(__builtin_ctzll(word))));
+            word &= word - 1;
+        }
+    }
+    std::vector<uint64_t>().swap(container.bits);
+}
+
+/**
+ * Converts an array container to a bitset container.
+ *
+ * @param container The container.
+ */
+void Bitmap::toBitset(Container &container) {
+    if(!container.bits.empty())
+        return;
+    container.bits.assign(BITSET_WORDS, 0);
+    for(uint16_t low : container.array)
+        container.bits[low >> 6] |= 1ULL << (low & 63);
+    std::vector<uint16_t>().swap(container.array);
+}
+
+/*
+ * Bitset kernels. Each combines a bitset with another in place, a vector register at a time when the target supports
+ * it, and returns the number of bits left set.
+ */
+
+uint32_t Bitmap::andWords(uint64_t* words, const uint64_t* other) {
+#if defined(__AVX2__)
+    for(uint32_t i = 0; i < BITSET_WORDS; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(other + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(words + i), _mm256_and_si256(a, b));
+    }
+#elif defined(__SSE2__)
+    for(uint32_t i = 0; i < BITSET_WORDS; i += 2) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(other + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(words + i), _mm_and_si128(a, b));
+    }
+#else
+    for(uint32_t i = 0; i < BITSET_WORDS; i++)
+        words[i] &= other[i];
+#endif
+    return countBits(words);
+}
+
+uint32_t Bitmap::andNotWords(uint64_t* words, const uint64_t* other) {
+#if defined(__AVX2__)
+    for(uint32_t i = 0; i < BITSET_WORDS; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(other + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(words + i), _mm256_andnot_si256(b, a));
+    }
+#elif defined(__SSE2__)
+    for(uint32_t i = 0; i < BITSET_WORDS; i += 2) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(other + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(words + i), _mm_andnot_si128(b, a));
+    }
+#else
+    for(uint32_t i = 0; i < BITSET_WORDS; i++)
+        words[i] &= ~other[i];
+#endif
+    return countBits(words);
+}
+
+uint32_t Bitmap::orWords(uint64_t* words, const uint64_t* other) {
+#if defined(__AVX2__)
+    for(uint32_t i = 0; i < BITSET_WORDS; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(other + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(words + i), _mm256_or_si256(a, b));
+    }
+#elif defined(__SSE2__)
+    for(uint32_t i = 0; i < BITSET_WORDS; i += 2) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(other + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(words + i), _mm_or_si128(a, b));
+    }
+#else
+    for(uint32_t i = 0; i < BITSET_WORDS; i++)
+        words[i] |= other[i];
+#endif
+    return countBits(words);
+}
+
+/**
+ * Counts the set bits in a bitset.
+ */
+uint32_t Bitmap::countBits(const uint64_t* words) {
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < BITSET_WORDS; i++)
+        count += static_cast<uint32_t>(__builtin_popcountll(words[i]));
+    return count;
+}
@@ -0,0 +1,86 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <tfc/buffer.h>
+#include <tfc/portable_endian.h>
+
+using namespace Tfc;
+
+/**
+ * Discards everything written to the buffer.
+ */
+void Buffer::clear() {
+    this->bytes.clear();
+}
+
+/**
+ * Appends raw bytes to the buffer.
+ *
+ * @param bytes Pointer to the bytes to append.
+ * @param size The number of bytes to append.
+ */
+void Buffer::writeBytes(const char* bytes, uint64_t size) {
+    this->bytes.insert(this->bytes.end(), bytes, bytes + size);
+}
+
+/**
+ * Appends a null-terminated string to the buffer.
+ *
+ * @param value The string to append.
+ */
+void Buffer::writeString(const std::string &value) {
+    this->writeBytes(value.c_str(), value.size() + 1); // + 1 for null terminator
+}
+
+/**
+ * Appends a uint8_t to the buffer.
+ *
+ * @param value The uint8_t value to append.
+ */
+void Buffer::writeUInt8(uint8_t value) {
+    this->bytes.push_back(static_cast<char>(value));
+}
+
+/**
+ * Appends a uint16_t to the buffer in big-endian byte order.
+ *
+ * @param value The uint16_t value to append.
+ */
+void Buffer::writeUInt16(uint16_t value) {
+    uint16_t networkByteValue = htobe16(value);
+    this->writeBytes(reinterpret_cast<const char*>(&networkByteValue), sizeof(uint16_t));
+}
+
+/**
+ * Appends a uint32_t to the buffer in big-endian byte order.
+ *
+ * @param value The uint32_t value to append.
+ */
+void Buffer::writeUInt32(uint32_t value) {
+    uint32_t networkByteValue = htobe32(value);
+    this->writeBytes(reinterpret_cast<const char*>(&networkByteValue), sizeof(uint32_t));
+}
+
+/**
+ * Appends a uint64_t to the buffer in big-endian byte order.
+ *
+ * @param value The uint64_t value to append.
+ */
+void Buffer::writeUInt64(uint64_t value) {
+    uint64_t networkByteValue = htobe64(value);
+    this->writeBytes(reinterpret_cast<const char*>(&networkByteValue), sizeof(uint64_t));
+}
@@ -0,0 +1,81 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <tfc/chunker.h>
+
+using namespace Tfc;
+
+const uint64_t Chunker::MIN_CHUNK_SIZE;
+const uint64_t Chunker::AVG_CHUNK_SIZE;
+const uint64_t Chunker::MAX_CHUNK_SIZE;
+
+/**
+ * Finds the end of the first chunk in a run of bytes. The cut point only depends on the bytes, so the same bytes
+ * always split into the same chunks.
+ *
+ * @param bytes Pointer to the bytes.
+ * @param size The number of bytes.
+ * @param final Whether no more bytes follow. If not, a cut point is only found once size reaches MAX_CHUNK_SIZE.
+ * @return The size of the first chunk in bytes, or 0 if more bytes are needed to find it.
+ */
+uint64_t Chunker::cut(const char* bytes, uint64_t size, bool final) {
+    if(!final && size < MAX_CHUNK_SIZE)
+        return 0;
+    if(size <= MIN_CHUNK_SIZE)
+        return size;
+    const uint64_t* table = gear();
+    auto* data = reinterpret_cast<const unsigned char*>(bytes);
+
+    // no chunk is smaller than the minimum size, so hashing starts there
+    uint64_t end = std::min(size, MAX_CHUNK_SIZE);
+    uint64_t normal = std::min(end, AVG_CHUNK_SIZE);
+    uint64_t hash = 0;
+    uint64_t i = MIN_CHUNK_SIZE;
+    for(; i < normal; i++) {
+        hash = (hash << 1) + table[data[i]];
+        if((hash & MASK_SMALL) == 0)
+            return i + 1;
+    }
+    for(; i < end; i++) {
+        hash = (hash << 1) + table[data[i]];
+        if((hash & MASK_LARGE) == 0)
+            return i + 1;
+    }
+    return end;
+}
+
+/**
+ * Returns the gear table, a random 64-bit value for each byte value which is rolled into the hash. The table is
+ * generated from a fixed seed, since chunks only match if every container splits bytes the same way.
+ */
+const uint64_t* Chunker::gear() {
+    struct Table {
+        uint64_t values[256];
+        Table() {
+            uint64_t state = 0xE621126E; // splitmix64, seeded with the container's magic number
+            for(uint64_t &value : values) {
+                uint64_t z = (state += 0x9E3779B97F4A7C15);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+                value = z ^ (z >> 31);
+            }
+        }
+    };
+    static const Table table;
+    return table.values;
+}
@@ -0,0 +1,138 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstring>
+#include <tfc/cursor.h>
+#include <tfc/exception.h>
+#include <tfc/portable_endian.h>
+
+using namespace Tfc;
+
+/**
+ * Creates a new cursor for parsing big-endian fields out of a buffer which is already in memory. The cursor does not
+ * own the buffer.
+ *
+ * @param data Pointer to the start of the buffer.
+ * @param size The size of the buffer in bytes.
+ */
+Cursor::Cursor(const char* data, uint64_t size) {
+    this->data = data;
+    this->size = size;
+}
+
+/**
+ * Returns a pointer to a run of bytes and moves the cursor past them. The bytes are not copied.
+ *
+ * @param size The number of bytes in the run.
+ * @return Pointer to the first byte in the run.
+ * @throw Exception The buffer ends before the run does.
+ */
+const char* Cursor::readBytes(uint64_t size) {
+    if(size > this->size - this->position)
+        throw Exception("Unexpected end of table data");
+    const char* bytes = this->data + this->position;
+    this->position += size;
+    return bytes;
+}
+
+/**
+ * Reads a null-terminated string and moves the cursor past its terminator.
+ *
+ * @return The string, without the terminator.
+ * @throw Exception The buffer ends before the terminator.
+ */
+std::string Cursor::readString() {
+    uint32_t length;
+    const char* start = this->readString(length);
+    return std::string(start, length);
+}
+
+/**
+ * Reads a null-terminated string in place and moves the cursor past its terminator.
+ *
+ * @param length Set to the number of bytes in the string, without the terminator.
+ * @return The start of the string in the buffer.
+ * @throw Exception The buffer ends before the terminator.
+ */
+const char* Cursor::readString(uint32_t &length) {
+    const char* start = this->data + this->position;
+    auto end = static_cast<const char*>(std::memchr(start, '\0', this->size - this->position));
+    if(end == nullptr)
+        throw Exception("Unexpected end of table data");
+    length = static_cast<uint32_t>(end - start);
+    this->position += static_cast<uint64_t>(length) + 1;
+    return start;
+}
+
+/**
+ * Reads a uint8.
+ *
+ * @throw Exception The buffer ends before the field.
+ */
+uint8_t Cursor::readUInt8() {
+    return static_cast<uint8_t>(*this->readBytes(sizeof(uint8_t)));
+}
+
+/**
+ * Reads a big-endian uint16.
+ *
+ * @throw Exception The buffer ends before the field.
+ */
+uint16_t Cursor::readUInt16() {
+    uint16_t value;
+    std::memcpy(&value, this->readBytes(sizeof(uint16_t)), sizeof(uint16_t));
+    return be16toh(value);
+}
+
+/**
+ * Reads a big-endian uint32.
+ *
+ * @throw Exception The buffer ends before the field.
+ */
+uint32_t Cursor::readUInt32() {
+    uint32_t value;
+    std::memcpy(&value, this->readBytes(sizeof(uint32_t)), sizeof(uint32_t));
+    return be32toh(value);
+}
+
+/**
+ * Reads an array of big-endian uint32s in one go and converts them to host byte order.
+ *
+ * @param values Array to read the values into.
+ * @param count The number of values to read.
+ * @throw Exception The buffer ends before the last value.
+ */
+void Cursor::readUInt32s(uint32_t* values, uint64_t count) {
+    if(count == 0)
+        return;
+    if(count > this->getRemaining() / sizeof(uint32_t))
+        throw Exception("Unexpected end of table data");
+    std::memcpy(values, this->readBytes(count * sizeof(uint32_t)), count * sizeof(uint32_t));
+    for(uint64_t i = 0; i < count; i++)
+        values[i] = be32toh(values[i]);
+}
+
+/**
+ * Reads a big-endian uint64.
+ *
+ * @throw Exception The buffer ends before the field.
+ */
+uint64_t Cursor::readUInt64() {
+    uint64_t value;
+    std::memcpy(&value, this->readBytes(sizeof(uint64_t)), sizeof(uint64_t));
+    return be64toh(value);
+}
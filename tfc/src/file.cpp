@@ -15,10 +15,17 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <cctype>
 #include <cstring>
 #include <chrono>
 #include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <xxhash/xxhash.h>
+#include <zstd/zstd.h>
 #include <tfc/portable_endian.h>
 #include <tfc/file.h>
 
@@ -43,6 +50,28 @@ File::File(const std::string &filename){
     // determine if the file exists
     std::ifstream stream(this->filename);
     this->exists = stream.good();
+
+    // the journal lives next to the container
+    this->journal = new Journal(this->filename + ".tfj");
+}
+
+/**
+ * Destroys the representation of the file, closing it first so that any changes which haven't been committed to the
+ * journal are written.
+ */
+File::~File() {
+    try {
+        this->mode(FileMode::CLOSED);
+    } catch(Exception &ex) {
+        // the journal still holds the last committed group, there's nothing else to do
+    }
+    this->unmap();
+    delete this->journal;
+    delete this->tagTable;
+    delete this->blobTable;
+    delete this->allocator;
+    ZSTD_freeCCtx(this->compressor);
+    ZSTD_freeDCtx(this->decompressor);
 }
 
 /**
@@ -57,128 +86,32 @@ uint32_t File::addBlob(const std::string &name, char* bytes, uint64_t size) {
     if(this->op != FileMode::EDIT) // file must be in EDIT mode
         throw Exception("File not in EDIT mode");
 
-    /*
-     * Write blob bytes to free blocks
-     */
-    std::streamsize remainingSize = size;       // number of bytes still left to write
-    uint64_t bytePos = 0;                // where we are in the byte array
-    std::streampos firstBlockPos;        // position of first block in the block chain
-    std::streampos lastBlockNextPos = 0; // position of next pos in last block
-    std::streampos blockListDataStart = this->blockListPos // start of block list data section
-                                        + static_cast<std::streampos>(BLOCK_LIST_COUNT_SIZE);
-    std::streampos selectedBlock = 0;     // currently selected block
-    while(remainingSize > 0) { // we still have bytes to write
-        bool isFirstBlock = selectedBlock == 0; // first block always starts with selectedBlock == 0
-
-        // find a free block
-        this->jump(blockListDataStart); // jump to block list data section start
-        char freeBlockBuf[BLOCK_SIZE];  // buffer for storing current block
-        while(selectedBlock < blockCount) { // only check existing blocks, we can also make new ones
-
-            // read block into memory
-            this->stream.read(freeBlockBuf, BLOCK_SIZE); // read block data and next pos (should be 0 for free blocks)
-
-            // check if block is free
-            bool free = true;
-            for(char byte : freeBlockBuf) {
-                if(byte != 0x0) {
-                    free = false;
-                    break;
-                }
-            }
-            if(free) { // we found a free block
-                this->jump(blockListDataStart + BLOCK_SIZE * selectedBlock); // move back to start of free block
-                break;
-            }
-
-            // move to next block
-            selectedBlock += 1;
-            this->jump(blockListDataStart + BLOCK_SIZE * selectedBlock);
-
-        }
-
-        // if first block, record first block's pos
-        if(isFirstBlock)
-            firstBlockPos = this->stream.tellg();
-
-        // update block count if we're writing to a new block
-        bool isNewBlock = selectedBlock >= blockCount;
-        if(isNewBlock) {
-
-            // jump to block count
-            this->jump(this->blockListPos);
-
-            // write new block count
-            this->writeUInt32(++this->blockCount);
-
-            // jump back to beginning of new block
-            this->jump(blockListDataStart + BLOCK_SIZE * selectedBlock);
-
-        }
-
-        // determine number of bytes we need to write in this block
-        std::streamsize blockDataSize;
-        if(remainingSize > BLOCK_DATA_SIZE)
-            blockDataSize = BLOCK_DATA_SIZE;
-        else
-            blockDataSize = remainingSize;
-
-        // write data to block
-        this->stream.write(bytes + bytePos, blockDataSize);
-        if(this->stream.fail())
-            throw Exception("Failed to write blob data");
-        bytePos += blockDataSize;
-
-        // update next pos of last block
-        if(lastBlockNextPos != 0) { // last block existed
-
-            // jump back to last block's next pos
-            this->jump(lastBlockNextPos);
-
-            // write start pos of selected block
-            this->writeUInt64(static_cast<uint64_t>(blockListDataStart + BLOCK_SIZE * selectedBlock));
-
+    // with deduplication on, a blob which is already stored isn't written again
+    if(this->deduplication && size > 0) {
+        uint64_t hash = XXH3_64bits_withSeed(bytes, size, MAGIC_NUMBER);
+        BlobRecord* original = this->findDuplicate(hash, size, bytes, nullptr);
+        if(original != nullptr) {
+            BlobRecord pending(0, name.data(), static_cast<uint32_t>(name.size()), HashAlgorithm::XXHASH3_64, hash,
+                               size);
+            pending.copyStorage(original);
+            return this->addRecord(&pending);
         }
-
-        // go to end of selected block's data section (start of next pos)
-        this->jump(blockListDataStart + BLOCK_SIZE * selectedBlock
-                   + static_cast<std::streampos>(BLOCK_DATA_SIZE));
-
-        // set this block's next pos so the next block will update it
-        lastBlockNextPos = this->stream.tellg();
-
-        // zero out next pos
-        char nextPosBuf[8] = {};
-        this->stream.write(nextPosBuf, BLOCK_NEXT_SIZE);
-
-        // subtract bytes we just wrote from remaining bytes
-        remainingSize -= blockDataSize;
-        selectedBlock += 1; // so next block we write starts after this block
-
     }
 
-    /*
-     * Rewrite tag table
-     */
-
-    this->jump(static_cast<uint64_t>(blockListDataStart) + BLOCK_SIZE * this->blockCount); // go to end of block list
-    this->writeTagTable();
-
-    /*
-     * Rewrite blob table with new entry
-     */
-
-    // compute a hash of the data
-    uint64_t hash = this->hash(bytes, size);
-
-    // create new record in blob table
-    auto* record = new BlobRecord(this->blobTableNextNonce++, name, hash, firstBlockPos, size);
-    this->blobTable->add(record);
-
-    // rewrite the blob table
-    this->writeBlobTable();
+    // write the whole blob in one go
+    BlobWriter* writer = this->writer(name);
+    writer->deduplicate = false; // already looked for
+    uint32_t nonce;
+    try {
+        writer->append(bytes, size);
+        nonce = writer->commit();
+    } catch(Exception &ex) {
+        delete writer;
+        throw;
+    }
+    delete writer;
 
-    return record->getNonce();
+    return nonce;
 }
 
 /**
@@ -201,16 +134,19 @@ void File::attachTag(uint32_t nonce, const std::string &tag) {
         throw Exception("No blob was found with ID " + std::to_string(nonce));
 
     // get the tag from the tag table, or make a new one if it doesn't exist
+    Buffer payload;
     TagRecord* tagRow = this->tagTable->get(tagLower);
     if(tagRow == nullptr) { // tag doesn't exist in table, add it
 
         // add a new tag to the tag table
-        tagRow = new TagRecord(this->tagTableNextNonce++, tagLower);
+        tagRow = this->arena.create<TagRecord>(this->tagTableNextNonce++, this->intern(tagLower),
+                                               static_cast<uint32_t>(tagLower.size()));
         this->tagTable->add(tagRow);
 
-        // write the tag table to disk
-        this->jump(this->tagTablePos);
-        this->writeTagTable();
+        // log the new tag
+        payload.writeUInt32(tagRow->getNonce());
+        payload.writeString(tagRow->getName());
+        this->logEntry(LogEntryType::TAG_ADD, payload);
 
     } else { // tag already exists in tag table
 
@@ -220,22 +156,92 @@ void File::attachTag(uint32_t nonce, const std::string &tag) {
                 throw Exception("Tag is already attached to this blob");
         }
 
-        // jump to blob table
-        this->jump(this->blobTablePos);
-
     }
 
     // link the blob and tag together
-    blobRow->addTag(tagRow);
-    tagRow->addBlob(blobRow);
+    this->linkTag(blobRow, tagRow);
+
+    // log the link
+    payload.clear();
+    payload.writeUInt32(blobRow->getNonce());
+    payload.writeUInt32(tagRow->getNonce());
+    this->logEntry(LogEntryType::TAG_ATTACH, payload);
+    this->flushLog();
+}
+
+/**
+ * EDIT operation. Opens a batch of mutations. Mutations made through the batch, or directly on the file while the
+ * batch is open, are applied right away, but the changes to the tables are only written when the batch is committed.
+ * This means the tables are written once for the whole batch rather than once per mutation. The caller owns the batch
+ * and must delete it. Only one batch can be open at a time.
+ *
+ * @return The batch.
+ * @throw Exception The file is not in EDIT mode or a batch is already open.
+ */
+WriteBatch* File::batch() {
+    if(this->op != FileMode::EDIT)
+        throw Exception("File not in EDIT mode");
+    if(this->openBatch != nullptr)
+        throw Exception("A batch is already open");
+
+    this->openBatch = new WriteBatch(this);
+    return this->openBatch;
+}
+
+/**
+ * EDIT operation. Begins a transaction. Mutations made while the transaction is open, including those made through a
+ * batch, are applied to the in-memory tables right away, but none of them are written to the tables until the
+ * transaction is committed. They are then written with a single append to the table log and a single journal commit.
+ * If the transaction is rolled back, or the process dies before it is committed, none of them are kept. Only one
+ * transaction can be open at a time.
+ *
+ * @throw Exception The file is not in EDIT mode, or a transaction or a batch is already open.
+ */
+void File::begin() {
+    if(this->op != FileMode::EDIT)
+        throw Exception("File not in EDIT mode");
+    if(this->transaction)
+        throw Exception("A transaction is already open");
+    if(this->openBatch != nullptr)
+        throw Exception("A batch is already open");
+
+    // start from committed tables, so that rolling back only needs to reload them
+    this->flushLog();
+    this->commitGroup();
+    this->transaction = true;
+}
+
+/**
+ * EDIT operation. Commits the open transaction, writing the changes to the tables made by every mutation in it in one
+ * go. A batch opened in the transaction is committed along with it.
+ *
+ * @throw Exception The file is not in EDIT mode, no transaction is open, or the changes could not be committed.
+ */
+void File::commit() {
+    if(this->op != FileMode::EDIT)
+        throw Exception("File not in EDIT mode");
+    if(!this->transaction)
+        throw Exception("No transaction is open");
+
+    // a batch opened in the transaction is part of it
+    if(this->openBatch != nullptr) {
+        this->openBatch->done = true;
+        this->openBatch = nullptr;
+    }
 
-    // write the blob table to disk
-    this->writeBlobTable();
+    this->transaction = false;
+    this->flushLog();
+    this->commitGroup();
 }
 
 /**
  * Deletes a blob with the specified nonce from the file. The file will be deleted by setting all bytes for the file's
- * blocks to 0x0 and deleting the blob's entry in the blob table. The nonce will not be re-used.
+ * blocks to 0x0 and deleting the blob's entry in the blob table. The nonce will not be re-used. If the blob shares its
+ * blocks with a deduplicated blob, the blocks are left alone until the last blob using them is deleted.
+ *
+ * Note on concurrency: Readers in other processes are never waited for. Once the deletion is committed, its blocks are
+ * overwritten and may be reused, even if another process is still streaming the blob through a reader it opened from
+ * tables read before the deletion. That reader then reads zeroes or another blob's bytes.
  *
  * Note on security: Depending on the host filesystem (especially with journaled filesystems), the deleted blob's bytes
  * may be backed up elsewhere. Additionally, only one pass is made. Therefore, you should not assume that the blob wil
@@ -253,74 +259,14 @@ void File::deleteBlob(uint32_t nonce) {
     if (blobRecord == nullptr)
         throw Exception("No blob was found with ID " + std::to_string(nonce));
 
-    // move to blob's starting block
-    std::streampos startPos = blobRecord->getStart();
-    this->jump(startPos);
-
-    // overwrite the blob's data
-    uint64_t remainingSize = blobRecord->getSize();
-    while (remainingSize > 0) {
-
-        // zero out the block's data section
-        for (int i = 0; i < BLOCK_DATA_SIZE / 4; i++) // 4 bytes for a 32 bit int
-            this->writeUInt32(0x0);
-
-        // subtract bytes in block from bytes remaining
-        if (remainingSize <= BLOCK_DATA_SIZE)
-            remainingSize = 0;
-        else
-            remainingSize -= BLOCK_DATA_SIZE;
-
-        // read next position and zero it out
-        std::streampos nextPosStart = this->stream.tellg();
-        uint64_t nextPos = this->readUInt64();
-        this->jump(nextPosStart);
-        this->writeUInt64(0x0);
-
-        // jump to next block
-        if (nextPos != 0x0)
-            this->jump(nextPos);
-    }
-
-    // remove blob record from tag records
-    bool rewriteTagTable = false; // whether the tag table needs to be rewritten
-    for (TagRecord* tagRecord : *blobRecord->getTags()) {
-
-        // locate index of blob record in tag record
-        unsigned long i;
-        bool found = false;
-        for (i = 0; i < tagRecord->getBlobs()->size(); i++) {
-            if ((*tagRecord->getBlobs())[i] == blobRecord) {
-                found = true;
-                break;
-            }
-        }
-        if (!found)
-            continue;
-
-        // delete the link from tag -> blob
-        tagRecord->getBlobs()->erase(tagRecord->getBlobs()->begin() + i);
-
-        // no more blobs left in tag, delete the tag
-        if (tagRecord->getBlobs()->empty()) {
-            this->tagTable->remove(tagRecord);
-            delete tagRecord;
-            rewriteTagTable = true;
-        }
-    }
-
-    // remove blob record from blob table
-    this->blobTable->remove(blobRecord);
-    delete blobRecord;
+    // remove the blob from the tables, its blocks are overwritten and freed once the deletion is committed
+    this->removeBlob(blobRecord, false);
 
-    // rewrite tables
-    if (rewriteTagTable) {
-        this->jump(this->tagTablePos);
-        this->writeTagTable();
-    } else {
-        this->jump(this->blobTablePos);
-    }
-    this->writeBlobTable();
+    // log the deletion
+    Buffer payload;
+    payload.writeUInt32(nonce);
+    this->logEntry(LogEntryType::BLOB_DELETE, payload);
+    this->flushLog();
 }
 
 /**
@@ -330,6 +276,13 @@ bool File::doesExist() {
     return this->exists;
 }
 
+/**
+ * Returns the size of the container's blocks in bytes.
+ */
+uint32_t File::getBlockSize() {
+    return this->blockSize;
+}
+
 /**
  * Returns the current operation mode of the file.
  */
@@ -341,34 +294,65 @@ FileMode File::getMode() {
  * Writes out the structure of an empty container file. Overwrites all file data.
  * Must be in CREATE mode.
  *
- * @throw Exception The file is not in CREATE mode.
+ * @param blockSize The size of a block in bytes. Blobs are stored in whole blocks, so larger blocks suit large blobs
+ *                  and smaller blocks waste less space on small blobs. Must be a power of two between MIN_BLOCK_SIZE
+ *                  and MAX_BLOCK_SIZE.
+ * @throw Exception The file is not in CREATE mode or the block size is invalid.
  */
-void File::init() {
+void File::init(uint32_t blockSize) {
     if(this->op != FileMode::CREATE)
         throw Exception("File not in CREATE mode");
+    if(!isValidBlockSize(blockSize))
+        throw Exception("Block size must be a power of two between " + std::to_string(MIN_BLOCK_SIZE) + " and "
+                        + std::to_string(MAX_BLOCK_SIZE) + " bytes");
     this->jump(0); // move cursor to beginning of file
+    this->headerPos = 0;
 
     // write header data
     this->writeUInt32(MAGIC_NUMBER); // write magic number
     this->writeUInt32(FILE_VERSION); // write file version
+    this->writeUInt32(blockSize);    // write block size
+    this->blockSize = blockSize;
 
     // write DEK as all 0s (since there's no encryption yet)
     for(int i = 0; i < 8; i++) // 32 * 8 is 256, the size of the DEK
         this->writeUInt32(0x0);
 
-    // write block list - just the count (which is 0) for now
-    this->writeUInt32(0);
-
-    // write tag table - for an empty container, this is the next nonce (1) and the count
-    this->writeUInt32(1);
-    this->writeUInt32(0);
+    // write an empty table root, it is filled in once the tables have been written
+    for(unsigned int i = 0; i < TABLE_ROOT_LEN; i += 4)
+        this->writeUInt32(0x0);
 
-    // write blob table - for an empty container, this is the next nonce (1) and the blob count (0)
-    this->writeUInt32(1);
+    // write block list - just the count (which is 0) for now
+    this->blockListPos = this->tell();
     this->writeUInt32(0);
 
-    // flush the buffer
-    this->stream.flush();
+    // build empty tables in memory, the next nonces start at 1, the old tables' records are freed along with them
+    this->tagTableNextNonce = 1;
+    this->blobTableNextNonce = 1;
+    delete this->tagTable;
+    delete this->blobTable;
+    this->arena.reset();
+    this->tagTable = new TagTable();
+    this->blobTable = new BlobTable();
+    delete this->allocator;
+    this->allocator = new BlockAllocator(0);
+    this->snapshotExtent = { 0, 0 };
+    this->logExtent = { 0, 0 };
+    this->logSalt = 0;
+    this->pendingLog.clear();
+    this->diskBlockCount = 0;
+    this->pendingFree.clear();
+    this->pendingZero.clear();
+    this->pendingOperations = 0;
+    this->rootPending = false;
+
+    // a journal left over from an old container must never be replayed over the new one
+    this->journal->discard();
+
+    // write the empty tables into the block list
+    this->tablesLoaded = false;
+    this->writeSnapshot();
+    this->tablesLoaded = true;
 
     // the file exists now, update state
     this->exists = true;
@@ -376,83 +360,152 @@ void File::init() {
 
 /**
  * READ operation. Given a vector of tag strings, a vector of BlobRecords are returned whose tags match all of the
- * tag strings. This vector will be returned in a descending order of nonces.
+ * tag strings. This vector will be returned in an ascending order of nonces. The tags' bitmaps are intersected
+ * starting from the rarest tag's.
  *
  * @param tags A vector of tags
- * @return A vector of BlobRecords whose tags contain all of the tags in the tags parameter.
+ * @return A vector of BlobRecords whose tags contain all of the tags in the tags parameter. The records are only valid
+ *         while the file stays in READ mode.
  */
 std::vector<BlobRecord*> File::intersection(const std::vector<std::string> &tags) {
     if(this->op != FileMode::READ)
         throw Exception("File not in READ mode");
 
-    std::vector<BlobRecord*> result; // set of intersecting BlobRecords
-
     // build a search set of TagRecords
-    std::vector<TagRecord*> searchSet;
-    for(const auto &tag : tags) {
-
-        // convert tag to lower case
-        std::string tagLower = tag;
-        std::transform(tagLower.begin(), tagLower.end(), tagLower.begin(), ::tolower);
-
-        // get tag record
-        TagRecord* record = this->tagTable->get(tagLower);
-        if(record == nullptr)
-            throw Exception(tagLower + " is not a tag");
-        searchSet.push_back(record);
+    std::vector<TagRecord*> searchSet = this->lookupTags(tags);
+    if(searchSet.empty())
+        return std::vector<BlobRecord*>();
 
-    }
+    // start from the rarest tag, since no blob can match without it
+    std::sort(searchSet.begin(), searchSet.end(), [](TagRecord* tag1, TagRecord* tag2) {
+        return tag1->getBlobs()->size() < tag2->getBlobs()->size();
+    });
 
-    // sort the search set
-    std::sort(searchSet.begin(), searchSet.end(), TagRecord::asc);
+    // narrow the rarest tag's blobs down to those which have every other tag
+    Bitmap result = *searchSet.front()->getBlobs();
+    for(size_t i = 1; i < searchSet.size() && !result.empty(); i++)
+        result.intersect(*searchSet[i]->getBlobs());
 
-    // build a union set of blob records (a set of blobs that have at least one of the tags)
-    auto* unionSet = new std::vector<BlobRecord*>();
-    for(const auto &tagRecord : searchSet) { // for each tag in search set
-        std::vector<BlobRecord*> blobs = *tagRecord->getBlobs(); // vector of blobs with this tag
-        std::sort(blobs.begin(), blobs.end(), BlobRecord::asc);
+    return this->recordsFor(result);
 
-        // union blob with union set
-        auto* newUnionSet = new std::vector<BlobRecord*>(unionSet->size() + blobs.size()); // pointer to the new union set
-        std::vector<BlobRecord*>::iterator end;
-        end = std::set_union(unionSet->begin(), unionSet->end(), blobs.begin(), blobs.end(), newUnionSet->begin(),
-                             BlobRecord::asc);
+}
 
-        // resize new union set
-        newUnionSet->resize(static_cast<unsigned long>(end - newUnionSet->begin()));
+/**
+ * READ operation. Finds the blobs which have all of a set of tags and none of another. The excluded tags' bitmaps are
+ * subtracted from the intersection of the included tags' bitmaps.
+ *
+ * @param tags The tags the blobs must have. If empty, every blob is included.
+ * @param excluded The tags the blobs must not have.
+ * @return The matching blobs, in ascending order of nonce, valid while the file stays in READ mode.
+ * @throw Exception One of the tags does not exist.
+ */
+std::vector<BlobRecord*> File::difference(const std::vector<std::string> &tags,
+                                          const std::vector<std::string> &excluded) {
+    if(this->op != FileMode::READ)
+        throw Exception("File not in READ mode");
 
-        // swap in new union set
-        auto* oldUnionSet = unionSet;
-        unionSet = newUnionSet;
-        delete oldUnionSet;
+    // start from the blobs with all of the tags, or every blob
+    Bitmap result;
+    std::vector<TagRecord*> searchSet = this->lookupTags(tags);
+    std::vector<TagRecord*> excludedSet = this->lookupTags(excluded);
+    if(searchSet.empty()) {
+        for(BlobRecord* record : *this->blobTable)
+            result.add(record->getNonce());
+    } else {
+        std::sort(searchSet.begin(), searchSet.end(), [](TagRecord* tag1, TagRecord* tag2) {
+            return tag1->getBlobs()->size() < tag2->getBlobs()->size();
+        });
+        result = *searchSet.front()->getBlobs();
+        for(size_t i = 1; i < searchSet.size() && !result.empty(); i++)
+            result.intersect(*searchSet[i]->getBlobs());
     }
 
-    // intersect each blob in the union set with the search set
-    for(const auto &blobRecord : *unionSet) {
+    // drop the blobs with any of the excluded tags
+    for(size_t i = 0; i < excludedSet.size() && !result.empty(); i++)
+        result.subtract(*excludedSet[i]->getBlobs());
 
-        // sort the blob record's tags
-        std::vector<TagRecord*> blobTags = *blobRecord->getTags();
-        std::sort(blobTags.begin(), blobTags.end(), TagRecord::asc);
+    return this->recordsFor(result);
+}
 
-        // check if the search set's tags are in the blob record's tags
-        std::vector<TagRecord*> intersection(searchSet.size());
-        std::vector<TagRecord*>::iterator end;
-        end = std::set_intersection(searchSet.begin(), searchSet.end(), blobTags.begin(), blobTags.end(),
-                                    intersection.begin(), TagRecord::asc);
+/**
+ * READ operation. Finds the blobs stashed with a name, through an index of the names rather than a scan of every blob.
+ * A name ending in * finds the blobs whose names start with the rest of it. Names are case sensitive.
+ *
+ * @param name The name, or a prefix followed by *.
+ * @return The matching blobs, in order of name and then of nonce, valid while the file stays in READ mode.
+ */
+std::vector<BlobRecord*> File::findBlobsByName(const std::string &name) {
+    if(this->op != FileMode::READ)
+        throw Exception("File not in READ mode");
 
-        // resize the intersection set
-        intersection.resize(static_cast<unsigned long>(end - intersection.begin()));
+    if(!name.empty() && name.back() == '*')
+        return this->blobTable->getByNamePrefix(name.substr(0, name.size() - 1));
+    return this->blobTable->getByName(name);
+}
 
-        // if tags match, add this record to the resultant set
-        if(intersection.size() == searchSet.size())
-            result.push_back(blobRecord);
+/**
+ * READ operation. Finds the tags matching a pattern, without scanning every tag.
+ * - A pattern with * or ? is a wildcard pattern. * matches any run of characters and ? matches any one character, so
+ *   "year:2019*" finds the tags starting with "year:2019".
+ * - A pattern ending in ~ and an optional distance, such as "colour~2", finds the tags within that many inserted,
+ *   deleted or replaced characters of the name before the ~, the closest first. The distance defaults to 1.
+ * - Any other pattern finds the tag with that name.
+ * Tags are case insensitive.
+ *
+ * @param pattern The pattern.
+ * @return The matching tags, in order of name unless the search is fuzzy, valid while the file stays in READ mode.
+ * @throw Exception The distance of a fuzzy pattern is invalid.
+ */
+std::vector<TagRecord*> File::findTags(const std::string &pattern) {
+    if(this->op != FileMode::READ)
+        throw Exception("File not in READ mode");
 
+    // convert pattern to lower case
+    std::string patternLower = pattern;
+    std::transform(patternLower.begin(), patternLower.end(), patternLower.begin(), ::tolower);
+
+    const TagTrie* trie = this->tagTable->getTrie();
+    size_t tilde = patternLower.rfind('~');
+    if(tilde != std::string::npos) {
+        std::string distance = patternLower.substr(tilde + 1);
+        if(distance.empty())
+            return trie->similar(patternLower.substr(0, tilde), DEFAULT_FUZZY_DISTANCE);
+        if(distance.size() > 1 || !std::isdigit(static_cast<unsigned char>(distance[0])) ||
+           static_cast<uint32_t>(distance[0] - '0') > MAX_FUZZY_DISTANCE)
+            throw Exception("Invalid distance in " + pattern + ", the largest is " +
+                            std::to_string(MAX_FUZZY_DISTANCE));
+        return trie->similar(patternLower.substr(0, tilde), static_cast<uint32_t>(distance[0] - '0'));
     }
 
-    delete unionSet;
+    if(patternLower.find_first_of("*?") != std::string::npos)
+        return trie->match(patternLower);
+
+    std::vector<TagRecord*> records;
+    TagRecord* record = this->tagTable->get(patternLower);
+    if(record != nullptr)
+        records.push_back(record);
+    return records;
+}
+
+/**
+ * Whether new blobs are split into chunks which share the blocks of identical chunks that are already stored.
+ */
+bool File::isChunking() {
+    return this->chunking;
+}
 
-    return result;
+/**
+ * Whether new blobs are compressed.
+ */
+bool File::isCompressing() {
+    return this->compression;
+}
 
+/**
+ * Whether new blobs share the blocks of identical blobs which are already stored.
+ */
+bool File::isDeduplicating() {
+    return this->deduplication;
 }
 
 /**
@@ -469,18 +522,28 @@ bool File::isUnlocked() {
     return this->unlocked;
 }
 
+/**
+ * Whether a block size can be used by a container.
+ *
+ * @param blockSize The size of a block in bytes.
+ * @return True if the block size is a power of two between MIN_BLOCK_SIZE and MAX_BLOCK_SIZE.
+ */
+bool File::isValidBlockSize(uint32_t blockSize) {
+    return blockSize >= MIN_BLOCK_SIZE && blockSize <= MAX_BLOCK_SIZE && (blockSize & (blockSize - 1)) == 0;
+}
+
 /**
  * READ operation. Returns a list of blob table entries.
  *
- * @return A vector of pointers to the entries.
+ * @return A vector of pointers to the entries, valid while the file stays in READ mode.
  */
 std::vector<BlobRecord*> File::listBlobs() {
     if(this->op != FileMode::READ)
         throw Exception("File not in READ mode");
 
     std::vector<BlobRecord*> rows;
-    for (auto &iter : *this->blobTable)
-        rows.push_back(iter.second);
+    for (BlobRecord* record : *this->blobTable)
+        rows.push_back(record);
 
     return rows;
 }
@@ -488,26 +551,36 @@ std::vector<BlobRecord*> File::listBlobs() {
 /**
  * READ operation. Returns a list of tag table entries.
  *
- * @return A vector of pointers to the entries.
+ * @return A vector of pointers to the entries, in order of name, valid while the file stays in READ mode.
  */
 std::vector<TagRecord*> File::listTags() {
     if(this->op != FileMode::READ)
         throw Exception("File not in READ mode");
 
-    std::vector<TagRecord*> rows;
-    for (auto &iter : *this->tagTable)
-        rows.push_back(iter.second);
-
-    return rows;
+    return this->tagTable->getTrie()->prefixed("");
 }
 
 /**
- * Switches the operating mode to CLOSED, READ, CREATE, or EDIT.
+ * Switches the operating mode to CLOSED, READ, CREATE, or EDIT. The tables stay in memory between modes, and are only
+ * read again when entering READ or EDIT mode if another process has changed them since.
  *
  * @param mode The mode to switch to.
  * @throw Exception Failed to open the file in that mode.
  */
 void File::mode(FileMode mode) {
+
+    // a batch can't outlive EDIT mode, write out anything it deferred and empty the journal
+    if(this->op == FileMode::EDIT && mode != FileMode::EDIT) {
+        if(this->transaction) // a transaction which wasn't committed is rolled back
+            this->rollback();
+        this->tablesLoaded = false; // the file is behind the tables until every change has been written
+        this->endBatch();
+        this->commitGroup();
+        this->journal->checkpoint(this->stream);
+        this->journal->close();
+        this->tablesLoaded = true;
+    }
+
     switch(mode) {
         case FileMode::CLOSED: // close stream and clear flags
             if(this->op == FileMode::CLOSED)
@@ -521,14 +594,19 @@ void File::mode(FileMode mode) {
             if(this->op != FileMode::CLOSED)
                 this->reset();
 
-            // open file for reading
+            // open file for reading without the journal's lock, a group left in the journal by a writer which died is
+            // replayed by the next writer, and until then the file holds the tables of a root which was committed
             this->stream.open(this->filename, std::ios::in | std::ios::binary);
             if(this->stream.fail())
                 throw Exception("Failed to open for reading");
             this->op = FileMode::READ;
 
-            // analyze the file
-            this->analyze();
+            // map the file into memory, reads fall back to the stream if it can't be mapped
+            this->map();
+
+            // analyze the file, unless the tables kept from the last time it was open are still current
+            if(this->tablesStale())
+                this->loadTables();
 
             break;
         case FileMode::CREATE: // open a new file
@@ -550,11 +628,26 @@ void File::mode(FileMode mode) {
             if(this->op != FileMode::CLOSED)
                 this->reset();
 
+            // lock the journal, so that only one process edits the file at a time
+            this->journal->open(this->filename);
+
             // open file for writing
             this->stream.open(this->filename, std::ios::in | std::ios::out | std::ios::binary);
-            if(this->stream.fail())
+            if(this->stream.fail()) {
+                this->journal->close();
                 throw Exception("Failed to open for editing");
+            }
             this->op = FileMode::EDIT;
+
+            // another process may have changed the tables since they were read
+            try {
+                if(this->tablesStale())
+                    this->reloadTables();
+            } catch(Exception &ex) {
+                this->reset();
+                this->journal->close();
+                throw;
+            }
             break;
         default:
             throw Exception("Invalid mode");
@@ -565,9 +658,61 @@ void File::mode(FileMode mode) {
  * READ operation. Reads a blob with the specified nonce.
  *
  * @param nonce The nonce of the blob to read.
- * @return A Blob struct containing the size and char* to the data. Null if the nonce does not exist.
+ * @return A Blob struct containing the size and char* to the data. Null if the nonce does not exist. The data is the
+ *         caller's, while the record is only valid while the file stays in READ mode.
  */
 Blob* File::readBlob(uint32_t nonce) {
+    BlobReader* reader = this->reader(nonce);
+
+    // create a new blob struct
+    auto* blob = new Blob();
+    blob->record = reader->getRecord();
+
+    // allocate memory for storing the blob bytes
+    blob->data = new char[blob->record->getSize()];
+
+    // read the whole blob into the buffer
+    try {
+        reader->read(blob->data, blob->record->getSize());
+    } catch(Exception &ex) {
+        delete [] blob->data;
+        delete blob;
+        delete reader;
+        throw;
+    }
+    delete reader;
+
+    return blob;
+
+}
+
+/**
+ * READ operation. Parses a query of tags joined by AND, OR and NOT and grouped with parentheses, such as
+ * "(cat OR dog) AND NOT blurry". Tags written next to each other must both match, so "cat dog" is "cat AND dog". The
+ * operators must be upper case, since tags are not. The query finds its results one at a time, starting from the tags
+ * with the fewest blobs. It can only be used while the file stays in READ mode. The caller owns the query and must
+ * delete it.
+ *
+ * @param expression The query.
+ * @return The query, positioned before its first result.
+ * @throw Exception The query is malformed, or one of its tags does not exist.
+ */
+BlobQuery* File::query(const std::string &expression) {
+    if(this->op != FileMode::READ)
+        throw Exception("File not in READ mode");
+    return new BlobQuery(this, expression);
+}
+
+/**
+ * READ operation. Opens a reader for reading a blob a piece at a time, so that the whole blob never needs to be held
+ * in memory. The reader can only be used while the file stays in READ mode. The caller owns the reader and must delete
+ * it. If another process deletes the blob while it is being read, the rest of what is read may be zeroes or another
+ * blob's bytes, since writers don't wait for readers before reusing blocks.
+ *
+ * @param nonce The nonce of the blob to read.
+ * @return A reader for the blob.
+ */
+BlobReader* File::reader(uint32_t nonce) {
     if(this->op != FileMode::READ)
         throw Exception("File not in READ mode");
 
@@ -576,45 +721,123 @@ Blob* File::readBlob(uint32_t nonce) {
     if(record == nullptr)
         throw Exception("No blob was found with ID " + std::to_string(nonce));
 
-    // create a new blob struct
-    auto* blob = new Blob();
-    blob->record = record;
+    return new BlobReader(this, record);
+}
+
+/**
+ * EDIT operation. Rolls back the open transaction, undoing every mutation made in it. The tables are reloaded from the
+ * container, so records returned while the transaction was open must not be used afterwards. A batch opened in the
+ * transaction is rolled back along with it, and any writer opened in it must be committed or aborted first.
+ *
+ * @throw Exception The file is not in EDIT mode, no transaction is open, or the tables could not be reloaded.
+ */
+void File::rollback() {
+    if(this->op != FileMode::EDIT)
+        throw Exception("File not in EDIT mode");
+    if(!this->transaction)
+        throw Exception("No transaction is open");
 
-    // jump to blob file
-    std::streampos startPos = record->getStart();
-    this->jump(startPos);
+    // a batch opened in the transaction is part of it
+    if(this->openBatch != nullptr) {
+        this->openBatch->done = true;
+        this->openBatch = nullptr;
+    }
+    this->transaction = false;
+
+    // nothing has been written to the tables since the transaction began, so the blocks it released are still in use
+    // and the blocks it allocated are free as far as the container is concerned
+    this->pendingFree.clear();
+    this->pendingZero.clear();
+    this->pendingOperations = 0;
+    this->rootPending = false;
+    this->reloadTables();
+}
 
-    // allocate memory for storing the blob bytes
-    blob->data = new char[blob->record->getSize()];
+/**
+ * EDIT operation. Commits the changes made since the last commit to the journal, so that they survive a crash. Changes
+ * are otherwise committed in groups, when a batch or a transaction is committed, and when the file leaves EDIT mode. A
+ * group is also committed by the first change made once its oldest change is a second old, but a process which stops
+ * making changes must call this or leave EDIT mode for its last group to be committed. Nothing is committed while a
+ * batch or a transaction is open.
+ *
+ * @throw Exception The file is not in EDIT mode or the changes could not be committed.
+ */
+void File::sync() {
+    if(this->op != FileMode::EDIT)
+        throw Exception("File not in EDIT mode");
+    this->commitGroup();
+}
 
-    // read bytes from blocks
-    uint64_t remainingSize = blob->record->getSize();
-    while(remainingSize > 0) {
+/**
+ * READ operation. Finds the blobs which have any of a set of tags, by uniting the tags' bitmaps.
+ *
+ * @param tags The tags.
+ * @return The blobs with at least one of the tags, in ascending order of nonce, valid while the file stays in READ
+ *         mode.
+ * @throw Exception One of the tags does not exist.
+ */
+std::vector<BlobRecord*> File::unionOf(const std::vector<std::string> &tags) {
+    if(this->op != FileMode::READ)
+        throw Exception("File not in READ mode");
 
-        // determine number of bytes to read from block
-        uint64_t blockByteCount;
-        if(remainingSize > BLOCK_DATA_SIZE)
-            blockByteCount = BLOCK_DATA_SIZE;
-        else
-            blockByteCount = remainingSize;
+    Bitmap result;
+    for(TagRecord* tag : this->lookupTags(tags))
+        result.unite(*tag->getBlobs());
 
-        // read bytes into the buffer
-        this->stream.read(blob->data + (blob->record->getSize() - remainingSize), blockByteCount);
-        if(this->stream.fail())
-            throw Exception("Failed to read block");
+    return this->recordsFor(result);
+}
 
-        // subtract bytes we just read from remaining
-        remainingSize -= blockByteCount;
+/**
+ * Turns chunking on or off. With chunking on, new blobs are split into content-defined chunks of 16 KiB to 256 KiB, and
+ * a chunk whose content is identical to a chunk which is already stored shares that chunk's blocks instead of being
+ * stored again. Since the chunk boundaries depend on the content, blobs which only differ in places, such as versions
+ * of the same file, share most of their blocks. Chunks are matched by hash and then compared byte for byte. Each chunk
+ * starts on a new block, so chunking wastes half a block per chunk on average and suits the smaller block sizes. It is
+ * off by default.
+ *
+ * @param enabled Whether to chunk new blobs.
+ */
+void File::setChunking(bool enabled) {
+    this->chunking = enabled;
+}
 
-        // jump to position of next block
-        this->jump(startPos + static_cast<std::streampos>(BLOCK_DATA_SIZE));
-        startPos = this->readUInt64();
-        this->jump(startPos);
+/**
+ * Turns compression on or off. With compression on, new blobs are split into 128 KiB frames which are compressed with
+ * zstd one at a time, so any part of a blob can be read by only decompressing the frames holding it. A blob whose
+ * first frame shrinks by less than an eighth is stored uncompressed, as is any frame which doesn't get smaller.
+ * Chunked blobs aren't compressed. Compression is off by default.
+ *
+ * @param enabled Whether to compress new blobs.
+ */
+void File::setCompression(bool enabled) {
+    this->compression = enabled;
+}
 
-    }
+/**
+ * Turns deduplication on or off. With deduplication on, a blob whose content is identical to a blob which is already
+ * stored shares that blob's blocks instead of being stored again. Blobs are matched by content hash and then compared
+ * byte for byte, so blobs are only shared if they really are identical. Shared blocks are freed once the last blob
+ * using them is deleted. Deduplication is off by default, since comparing blobs costs a read of the stored copy.
+ *
+ * @param enabled Whether to deduplicate new blobs.
+ */
+void File::setDeduplication(bool enabled) {
+    this->deduplication = enabled;
+}
 
-    return blob;
+/**
+ * EDIT operation. Opens a writer for adding a blob to the container a piece at a time, so that the whole blob never
+ * needs to be held in memory. The blob is added to the container when the writer is committed. The caller owns the
+ * writer and must delete it.
+ *
+ * @param name The display name of the blob.
+ * @return A writer for the blob.
+ */
+BlobWriter* File::writer(const std::string &name) {
+    if(this->op != FileMode::EDIT)
+        throw Exception("File not in EDIT mode");
 
+    return new BlobWriter(this, name);
 }
 
 /*
@@ -623,34 +846,65 @@ Blob* File::readBlob(uint32_t nonce) {
  * ----------------
  */
 
+/**
+ * EDIT operation. Adds a record for a blob whose bytes have been stored to the blob table and logs it.
+ *
+ * @param pending A record describing the blob and its stored bytes. Its nonce is ignored.
+ * @return The container index that was assigned to the blob.
+ */
+uint32_t File::addRecord(BlobRecord* pending) {
+
+    // create new record in blob table
+    std::string name = pending->getName();
+    auto* record = this->arena.create<BlobRecord>(this->blobTableNextNonce++, this->intern(name),
+                                                  static_cast<uint32_t>(name.size()), pending->getHashAlgorithm(),
+                                                  pending->getHash(), pending->getSize());
+    record->copyStorage(pending);
+    record->copyInto(this->arena);
+    this->blobTable->add(record);
+
+    // log the new entry
+    Buffer payload;
+    this->encodeBlob(payload, record);
+    this->logEntry(LogEntryType::BLOB_ADD, payload);
+    uint32_t nonce = record->getNonce();
+    this->flushLog(); // may rebuild the tables, which frees the record
+
+    return nonce;
+}
+
 /**
  * READ mode operation. Analyzes the structure of the file. Finds the starting position of file sections, builds a
- * blob table for blobs, and builds a tag table for tags.
+ * blob table for blobs, and builds a tag table for tags from the table snapshot and the table log. Also used in EDIT
+ * mode to reload the tables when a transaction is rolled back.
  */
 void File::analyze() {
-    if(this->op != FileMode::READ)
+    if(this->op != FileMode::READ && this->op != FileMode::EDIT)
         throw Exception("File not in READ mode");
+    this->tablesLoaded = false;
     this->jump(0);
 
     // current state of the analyzer
     enum AnalyzeState {
         HEADER,
         BLOCK_LIST,
-        TAG_TABLE,
-        BLOB_TABLE,
+        TABLE_SNAPSHOT,
+        TABLE_LOG,
         END
     };
     int state = AnalyzeState::HEADER;
 
     // read based on state
     uint32_t magicNumber;
-    uint32_t tagCount;
-    uint32_t blobCount = 0;
+    uint32_t blockCount = 0;
     uint32_t version;
+    bool freeMapLoaded = false;
+    std::vector<char> tables; // table snapshot or log, if the file isn't mapped
+    Cursor cursor(nullptr, 0);
     while(state != AnalyzeState::END) {
         switch (state) {
-            case AnalyzeState::HEADER:
-                this->headerPos = this->stream.tellg(); // header position
+            case AnalyzeState::HEADER: {
+                this->headerPos = this->tell(); // header position
 
                 // check magic number
                 magicNumber = this->readUInt32();
@@ -659,12 +913,18 @@ void File::analyze() {
 
                 // check file version
                 version = this->readUInt32();
-                if(version > FILE_VERSION)
-                    throw Exception("Container version mismatch. Must be <= " + std::to_string(FILE_VERSION));
+                if(version != FILE_VERSION)
+                    throw Exception("Container version mismatch. Must be " + std::to_string(FILE_VERSION));
+
+                // read block size
+                this->blockSize = this->readUInt32();
+                if(!isValidBlockSize(this->blockSize))
+                    throw Exception("Container has an invalid block size");
 
                 // check if file is encrypted (DEK will be all 0s)
                 char dek[32];
-                this->stream.read(dek, DEK_LEN);
+                if(!this->readBytes(dek, DEK_LEN))
+                    throw Exception("Failed to read header");
                 for(char byte : dek) {
                     if (byte != 0x0) {
                         this->encrypted = true;
@@ -673,172 +933,587 @@ void File::analyze() {
                     }
                 }
 
+                // read the table root
+                char root[24];
+                if(!this->readBytes(root, TABLE_ROOT_LEN))
+                    throw Exception("Failed to read header");
+                Cursor rootCursor(root, TABLE_ROOT_LEN);
+                this->snapshotExtent.start = rootCursor.readUInt32();
+                this->snapshotExtent.length = rootCursor.readUInt32();
+                this->logExtent.start = rootCursor.readUInt32();
+                this->logExtent.length = rootCursor.readUInt32();
+                this->logSalt = rootCursor.readUInt64();
+
                 state++;
                 break;
+            }
             case AnalyzeState::BLOCK_LIST:
-                this->blockListPos = this->stream.tellg();
+                this->blockListPos = this->tell();
 
                 // read number of blocks
-                this->blockCount = this->readUInt32();
+                blockCount = this->readUInt32();
+                this->diskBlockCount = blockCount;
 
-                // skip over the blocks
-                this->next(BLOCK_SIZE * this->blockCount);
+                // the tables must be inside of the block list
+                if(this->snapshotExtent.length == 0 || this->snapshotExtent.start > blockCount
+                   || this->snapshotExtent.length > blockCount - this->snapshotExtent.start
+                   || this->logExtent.start > blockCount || this->logExtent.length > blockCount - this->logExtent.start)
+                    throw Exception("Container has a corrupt table root");
 
                 state++;
                 break;
-            case AnalyzeState::TAG_TABLE:
-                this->tagTablePos = this->stream.tellg(); // tag table position
-
-                // read next tag nonce
-                this->tagTableNextNonce = this->readUInt32();
-
-                // read tag count
-                tagCount = this->readUInt32();
-
-                // allocate new tag table (and dealloc any old one)
-                delete this->tagTable;
-                this->tagTable = new TagTable();
+            case AnalyzeState::TABLE_SNAPSHOT:
 
-                // build in-memory tag table
-                for(uint32_t i = 0; i < tagCount; i++) {
+                // get the whole snapshot in memory at once
+                cursor = this->readRegion(this->blockPos(this->snapshotExtent.start),
+                                          static_cast<uint64_t>(this->blockSize) * this->snapshotExtent.length, tables);
 
-                    // read nonce
-                    uint32_t nonce = this->readUInt32();
+                this->decodeTables(cursor);
 
-                    // read name string
-                    std::string name = this->readString();
-
-                    // add tag to tag table
-                    this->tagTable->add(new TagRecord(nonce, name));
-
-                }
+                // load the free map, the free block index is rebuilt later if it is missing or stale
+                delete this->allocator;
+                this->allocator = nullptr;
+                freeMapLoaded = this->readFreeMap(cursor, blockCount);
 
                 state++;
                 break;
-            case AnalyzeState::BLOB_TABLE:
-                this->blobTablePos = this->stream.tellg();
-
-                // read next blob nonce
-                this->blobTableNextNonce = this->readUInt32();
+            case AnalyzeState::TABLE_LOG:
 
-                // read blob count
-                blobCount = this->readUInt32();
+                // apply the changes made since the snapshot was written
+                cursor = this->readRegion(this->blockPos(this->logExtent.start),
+                                          static_cast<uint64_t>(this->blockSize) * this->logExtent.length, tables);
+                this->replayLog(cursor);
 
-                // allocate new blob table (and dealloc any old one)
-                delete this->blobTable;
-                this->blobTable = new BlobTable();
-
-                // read blob table entries
-                for(uint32_t i = 0; i < blobCount; i++) {
+                state++;
+                break;
 
-                    // get nonce
-                    uint32_t nonce = this->readUInt32();
+            default:
+                return;
+        }
+    }
 
-                    // read the name
-                    std::string name = this->readString();
+    // index the free blocks if the free map couldn't be used
+    if(!freeMapLoaded)
+        this->buildAllocator(blockCount);
+    this->pendingLog.clear();
+    this->tablesLoaded = true;
 
-                    // read the hash
-                    uint64_t hash = this->readUInt64();
+}
 
-                    // get start position
-                    uint64_t start = this->readUInt64();
+/**
+ * READ mode operation. Applies an entry from the table log to the in-memory tables and, if it has been loaded, the
+ * free block index.
+ *
+ * @param type The type of the entry.
+ * @param cursor Cursor over the entry's payload.
+ * @return False if the entry refers to blocks past the end of the block list. The block list is always grown before
+ *         such an entry is appended, so the entry was appended after the size of the block list was read and the log
+ *         ends before it.
+ * @throw Exception The entry doesn't match the tables.
+ */
+bool File::applyLogEntry(uint8_t type, Cursor &cursor) {
+    switch(type) {
+        case LogEntryType::BLOB_ADD: {
+            BlobRecord* record = this->decodeBlob(cursor, false);
+            if(this->blobTable->get(record->getNonce()) != nullptr)
+                throw Exception("Table log adds a blob which already exists");
+
+            // mark the blob's blocks as in use
+            for(const Extent &extent : *record->getExtents()) {
+                if(extent.start > this->diskBlockCount || extent.length > this->diskBlockCount - extent.start)
+                    return false;
+                if(this->allocator != nullptr)
+                    this->allocator->use(extent.start, extent.length);
+            }
 
-                    // get size
-                    uint64_t size = this->readUInt64();
+            this->blobTable->add(record);
+            this->blobTableNextNonce = std::max(this->blobTableNextNonce, record->getNonce() + 1);
+            break;
+        }
+        case LogEntryType::BLOB_DELETE: {
+            BlobRecord* record = this->blobTable->get(cursor.readUInt32());
+            if(record == nullptr)
+                throw Exception("Table log deletes a blob which doesn't exist");
+            this->removeBlob(record, true);
+            break;
+        }
+        case LogEntryType::TAG_ADD: {
+            uint32_t nonce = cursor.readUInt32();
+            std::string name = cursor.readString();
+            if(this->tagTable->get(nonce) != nullptr || this->tagTable->get(name) != nullptr)
+                throw Exception("Table log adds a tag which already exists");
+            this->tagTable->add(this->arena.create<TagRecord>(nonce, this->intern(name),
+                                                              static_cast<uint32_t>(name.size())));
+            this->tagTableNextNonce = std::max(this->tagTableNextNonce, nonce + 1);
+            break;
+        }
+        case LogEntryType::TAG_ATTACH: {
+            BlobRecord* blob = this->blobTable->get(cursor.readUInt32());
+            TagRecord* tag = this->tagTable->get(cursor.readUInt32());
+            if(blob == nullptr || tag == nullptr)
+                throw Exception("Table log attaches a tag which doesn't exist");
+            this->linkTag(blob, tag);
+            break;
+        }
+        default:
+            throw Exception("Table log has an unknown entry");
+    }
+    return true;
+}
 
-                    // build blob record
-                    BlobRecord* blobRecord = new BlobRecord(nonce, name, hash, start, size);
+/**
+ * Returns the byte position of a block in the block list.
+ *
+ * @param block The index of the block.
+ * @return The position of the start of the block's data section.
+ */
+std::streampos File::blockPos(uint32_t block) {
+    return this->blockListPos + static_cast<std::streamoff>(BLOCK_LIST_COUNT_SIZE)
+           + static_cast<std::streamoff>(this->blockSize) * block;
+}
 
-                    // read tag count
-                    uint32_t blobTagCount = this->readUInt32();
+/**
+ * Returns the number of blocks needed to hold a number of bytes.
+ *
+ * @param size The number of bytes.
+ */
+uint32_t File::blocksFor(uint64_t size) {
+    return static_cast<uint32_t>((size + this->blockSize - 1) / this->blockSize);
+}
 
-                    // read in tags
-                    for(uint32_t j = 0; j < blobTagCount; j++) {
+/**
+ * READ mode operation. Builds the in-memory index of free blocks from the runs of blocks held by each blob and by the
+ * tables. Any other block is free.
+ *
+ * @param blockCount The number of blocks in the block list.
+ */
+void File::buildAllocator(uint32_t blockCount) {
+    delete this->allocator;
+    this->allocator = new BlockAllocator(blockCount);
+    this->allocator->use(this->snapshotExtent.start, this->snapshotExtent.length);
+    this->allocator->use(this->logExtent.start, this->logExtent.length);
+    for(BlobRecord* record : *this->blobTable) {
+        for(const Extent &extent : *record->getExtents()) {
+            if(extent.start > blockCount || extent.length > blockCount - extent.start)
+                throw Exception("Blob " + std::to_string(record->getNonce()) + " has a corrupt extent");
+            this->allocator->use(extent.start, extent.length);
+        }
+    }
+}
 
-                        // read tag nonce
-                        uint32_t tagNonce = this->readUInt32();
+/**
+ * EDIT operation. Commits the writes to the tables made since the last commit to the journal, then overwrites and
+ * frees the blocks that the committed tables no longer use. Blocks can't be reused before then, since the tables on
+ * disk would still point to them if the process died.
+ */
+void File::commitGroup() {
+    if(this->openBatch != nullptr || this->transaction) // a batch or a transaction is committed as a whole
+        return;
+
+    // the root goes last, so that readers never see it point to tables which haven't been written yet
+    if(this->rootPending) {
+        this->writeRoot();
+        this->rootPending = false;
+    }
+    this->journal->commit(this->stream);
+    this->pendingOperations = 0;
+
+    // overwrite deleted blobs' data
+    if(!this->pendingZero.empty()) {
+        std::vector<char> zeroes(this->blockSize);
+        for(const Extent &extent : this->pendingZero) {
+            this->jump(this->blockPos(extent.start));
+            for(uint32_t i = 0; i < extent.length; i++)
+                this->writeBytes(zeroes.data(), this->blockSize);
+        }
+        this->pendingZero.clear();
+        this->stream.flush();
+    }
 
-                        // get tag from the tag table
-                        TagRecord* tagRecord = this->tagTable->get(tagNonce);
-                        if(tagRecord == nullptr) // if tag doesn't exist, just ignore it
-                            continue;
+    // the blocks can be reused now
+    for(const Extent &extent : this->pendingFree)
+        this->allocator->free(extent.start, extent.length);
+    this->pendingFree.clear();
+}
 
-                        // link tag and blob together
-                        blobRecord->addTag(tagRecord);
-                        tagRecord->addBlob(blobRecord);
+/**
+ * Reads a blob record in the format used by the blob table and the table log. The record is linked to its tags.
+ *
+ * @param cursor Cursor positioned at the start of the record.
+ * @param indexed Whether the tags' bitmaps already hold the blob, as they do when it is read from the table snapshot.
+ * @return The record, which lives in the file's arena and must not be freed by the caller.
+ * @throw Exception The record is truncated.
+ */
+BlobRecord* File::decodeBlob(Cursor &cursor, bool indexed) {
+
+    // get nonce
+    uint32_t nonce = cursor.readUInt32();
+
+    // read the name, which is copied straight into the arena
+    uint32_t nameLength;
+    const char* name = cursor.readString(nameLength);
+
+    // read the hash and the algorithm it was made with
+    auto hashAlgorithm = static_cast<HashAlgorithm>(cursor.readUInt8());
+    uint64_t hash = cursor.readUInt64();
+
+    // get size
+    uint64_t size = cursor.readUInt64();
+
+    // read the codec and the stored size of each frame
+    auto codec = static_cast<Codec>(cursor.readUInt8());
+    uint32_t frameSize = cursor.readUInt32();
+    uint32_t frameCount = cursor.readUInt32();
+    if(codec != Codec::UNCOMPRESSED && codec != Codec::ZSTD)
+        throw Exception("Blob " + std::to_string(nonce) + " uses an unsupported codec");
+    if(codec == Codec::ZSTD ? frameSize == 0 || frameCount != (size + frameSize - 1) / frameSize : frameCount != 0)
+        throw Exception("Corrupt frame list in blob " + std::to_string(nonce));
+    if(frameCount > cursor.getRemaining() / 4)
+        throw Exception("Unexpected end of table data");
+    auto* blobRecord = this->arena.create<BlobRecord>(nonce, this->arena.copy(name, nameLength), nameLength,
+                                                      hashAlgorithm, hash, size);
+    blobRecord->setCompression(codec, frameSize);
+    *blobRecord->getFrames() = Span<uint32_t>(this->arena.allocateArray<uint32_t>(frameCount), frameCount);
+    cursor.readUInt32s(blobRecord->getFrames()->data(), frameCount);
+
+    // read the runs of blocks holding the blob, each is a pair of uint32s
+    uint32_t extentCount = cursor.readUInt32();
+    if(extentCount > cursor.getRemaining() / FREE_MAP_EXTENT_SIZE)
+        throw Exception("Unexpected end of table data");
+    Span<Extent> extents(this->arena.allocateArray<Extent>(extentCount), extentCount);
+    cursor.readUInt32s(reinterpret_cast<uint32_t*>(extents.data()), static_cast<uint64_t>(extentCount) * 2);
+    *blobRecord->getExtents() = extents;
+
+    // read the chunk each run holds, if the blob is chunked
+    uint32_t chunkCount = cursor.readUInt32();
+    if(chunkCount != 0 && (chunkCount != extentCount || chunkCount > cursor.getRemaining() / CHUNK_ENTRY_SIZE))
+        throw Exception("Corrupt chunk list in blob " + std::to_string(nonce));
+    Span<Chunk> chunks(this->arena.allocateArray<Chunk>(chunkCount), chunkCount);
+    for(uint32_t i = 0; i < chunkCount; i++) {
+        chunks[i].size = cursor.readUInt32();
+        chunks[i].hash = cursor.readUInt64();
+        if(chunks[i].size > static_cast<uint64_t>(this->blockSize) * extents[i].length)
+            throw Exception("Corrupt chunk list in blob " + std::to_string(nonce));
+    }
+    *blobRecord->getChunks() = chunks;
+
+    // read in tags
+    uint32_t blobTagCount = cursor.readUInt32();
+    if(blobTagCount > cursor.getRemaining() / NONCE_LEN)
+        throw Exception("Unexpected end of table data");
+    Span<TagRecord*> tags(indexed ? this->arena.allocateArray<TagRecord*>(blobTagCount) : nullptr, 0);
+    for(uint32_t i = 0; i < blobTagCount; i++) {
+
+        // get tag from the tag table
+        TagRecord* tagRecord = this->tagTable->get(cursor.readUInt32());
+        if(tagRecord == nullptr) // if tag doesn't exist, just ignore it
+            continue;
 
-                    }
+        // link tag and blob together
+        if(indexed) {
+            tags = Span<TagRecord*>(tags.data(), static_cast<uint32_t>(tags.size()) + 1);
+            tags[tags.size() - 1] = tagRecord;
+        } else {
+            this->linkTag(blobRecord, tagRecord);
+        }
 
-                    // add to blob to blob table
-                    this->blobTable->add(blobRecord);
-                }
+    }
+    if(indexed)
+        *blobRecord->getTags() = tags;
 
-                state++;
-                break;
+    return blobRecord;
+}
 
-            default:
-                return;
-        }
+/**
+ * Reads the tag table and the blob table from a table snapshot into new in-memory tables. The old tables are deleted
+ * and the arena holding their records is reset.
+ *
+ * @param cursor A cursor at the start of the snapshot, which is moved to the free map that follows the tables.
+ * @throw Exception The tables are corrupt.
+ */
+void File::decodeTables(Cursor &cursor) {
+
+    // read next tag nonce
+    this->tagTableNextNonce = cursor.readUInt32();
+
+    // read tag count
+    uint32_t tagCount = cursor.readUInt32();
+
+    // allocate new tables (and dealloc any old ones, along with their records)
+    delete this->tagTable;
+    delete this->blobTable;
+    this->arena.reset();
+    this->tagTable = new TagTable();
+    this->blobTable = new BlobTable();
+
+    // build in-memory tag table
+    for(uint32_t i = 0; i < tagCount; i++) {
+
+        // read nonce
+        uint32_t nonce = cursor.readUInt32();
+
+        // read name string
+        uint32_t nameLength;
+        const char* name = cursor.readString(nameLength);
+
+        // tables are indexed by nonce, so a nonce past the next one would only waste memory
+        if(nonce >= this->tagTableNextNonce)
+            throw Exception("Tag " + std::string(name, nameLength) + " has a corrupt nonce");
+
+        // add tag to tag table, along with the bitmap of its blobs
+        auto* tagRecord = this->arena.create<TagRecord>(nonce, this->arena.copy(name, nameLength), nameLength);
+        this->tagTable->add(tagRecord);
+        tagRecord->getBlobs()->decode(cursor);
+
+    }
+
+    // read next blob nonce
+    this->blobTableNextNonce = cursor.readUInt32();
+
+    // read blob count
+    uint32_t blobCount = cursor.readUInt32();
+
+    // make room for the blob table entries
+    this->blobTable->reserve(static_cast<uint32_t>(std::min<uint64_t>(blobCount, cursor.getRemaining() / NONCE_LEN)));
+
+    // read blob table entries
+    for(uint32_t i = 0; i < blobCount; i++) {
+        BlobRecord* record = this->decodeBlob(cursor, true);
+        if(record->getNonce() >= this->blobTableNextNonce)
+            throw Exception("Blob " + std::to_string(record->getNonce()) + " has a corrupt nonce");
+        this->blobTable->add(record);
+    }
+}
+
+/**
+ * Writes a blob record in the format used by the blob table and the table log.
+ *
+ * @param buffer The buffer to write the record to.
+ * @param record The record to write.
+ */
+void File::encodeBlob(Buffer &buffer, BlobRecord* record) {
+
+    // write nonce
+    buffer.writeUInt32(record->getNonce());
+
+    // write name
+    buffer.writeString(record->getName());
+
+    // write hash and the algorithm it was made with
+    buffer.writeUInt8(static_cast<uint8_t>(record->getHashAlgorithm()));
+    buffer.writeUInt64(record->getHash());
+
+    // write size
+    buffer.writeUInt64(record->getSize());
+
+    // write the codec and the stored size of each frame
+    buffer.writeUInt8(static_cast<uint8_t>(record->getCodec()));
+    buffer.writeUInt32(record->getFrameSize());
+    buffer.writeUInt32(static_cast<uint32_t>(record->getFrames()->size()));
+    for(uint32_t frame : *record->getFrames())
+        buffer.writeUInt32(frame);
+
+    // write the runs of blocks holding the blob
+    buffer.writeUInt32(static_cast<uint32_t>(record->getExtents()->size()));
+    for(const Extent &extent : *record->getExtents()) {
+        buffer.writeUInt32(extent.start);
+        buffer.writeUInt32(extent.length);
+    }
+
+    // write the chunk each run holds
+    buffer.writeUInt32(static_cast<uint32_t>(record->getChunks()->size()));
+    for(const Chunk &chunk : *record->getChunks()) {
+        buffer.writeUInt32(chunk.size);
+        buffer.writeUInt64(chunk.hash);
     }
 
+    // write tag count
+    buffer.writeUInt32(static_cast<uint32_t>(record->getTags()->size()));
+
+    // write each tag's nonce
+    for(auto tag : *record->getTags())
+        buffer.writeUInt32(tag->getNonce());
 }
 
 /**
- * Computes a hash from a byte array using the XXH64 variant of the xxHash algorithm.
+ * Writes the free block index in the free map format, counting blocks which are waiting to be freed as free. The free
+ * map must directly follow the blob table.
  *
- * @param bytes The bytes for which the hash will be computed.
- * @param size The size of the bytes
- * @return The computed hash for the bytes.
+ * @param buffer The buffer to write the map to.
  */
-uint64_t File::hash(char* bytes, size_t size) {
+void File::encodeFreeMap(Buffer &buffer) {
+
+    // blocks waiting on the journal are free as far as the tables being written are concerned
+    BlockAllocator allocator = *this->allocator;
+    for(const Extent &extent : this->pendingFree)
+        allocator.free(extent.start, extent.length);
+    const std::map<uint32_t, uint32_t>* extents = allocator.getExtents();
+    uint64_t start = buffer.getSize();
+
+    // write the map's header
+    buffer.writeUInt32(allocator.getBlockCount());
+    buffer.writeUInt32(this->blobTableNextNonce);
+    buffer.writeUInt32(this->blobTable->size());
+    buffer.writeUInt32(static_cast<uint32_t>(extents->size()));
+
+    // write the free extents
+    for(auto &extent : *extents) {
+        buffer.writeUInt32(extent.first);
+        buffer.writeUInt32(extent.second);
+    }
 
-    // create hash state for storing progress
-    XXH64_state_t* state = XXH64_createState();
-    if(state == nullptr) // error occurred
-        throw Exception("Failed to allocate hash state");
+    // write the map's checksum
+    buffer.writeUInt64(XXH64(buffer.getData() + start, buffer.getSize() - start, MAGIC_NUMBER));
+}
 
-    // allocate buffer
-    size_t bufferSize = this->HASH_BUFFER_SIZE; // size of the buffer
-    const char* buffer = (char*)malloc(bufferSize);
-    if(buffer == nullptr)
-        throw Exception("Failed to allocate hash buffer");
+/**
+ * Writes the tag table and the blob table from memory.
+ *
+ * @param buffer The buffer to write the tables to.
+ */
+void File::encodeTables(Buffer &buffer) {
 
-    // set the seed for this hash
-    const unsigned long long seed = this->MAGIC_NUMBER; // we'll just use the file's magic number as the seed
-    const XXH_errorcode resetResult = XXH64_reset(state, seed);
-    if(resetResult == XXH_ERROR)
-        throw Exception("Failed to seed the hash state");
+    // write next tag nonce and tag count
+    buffer.writeUInt32(this->tagTableNextNonce);
+    buffer.writeUInt32(this->tagTable->size());
 
-    // read bytes in blocks
-    while(size > 0) {
+    // write tag table entries
+    for(TagRecord* row : *this->tagTable) {
+        buffer.writeUInt32(row->getNonce());
+        buffer.writeString(row->getName());
+        row->getBlobs()->encode(buffer);
+    }
 
-        // determine how many bytes to read
-        size_t byteCount;
-        if(size >= this->HASH_BUFFER_SIZE)
-            byteCount = this->HASH_BUFFER_SIZE;
-        else
-            byteCount = size;
+    // write next blob nonce and blob count
+    buffer.writeUInt32(this->blobTableNextNonce);
+    buffer.writeUInt32(this->blobTable->size());
 
-        // read bytes into buffer
-        std::memcpy(bytes, buffer, byteCount);
+    // write blob table entries
+    for(BlobRecord* record : *this->blobTable)
+        this->encodeBlob(buffer, record);
+}
 
-        // add buffer to hash
-        XXH_errorcode addResult = XXH64_update(state, buffer, byteCount);
-        if(addResult == XXH_ERROR)
-            throw Exception("Failed to update hash state with block");
+/**
+ * EDIT operation. Closes the open batch, if there is one, and writes the table log entries it deferred.
+ */
+void File::endBatch() {
+    if(this->openBatch == nullptr)
+        return;
+    this->openBatch->done = true;
+    this->openBatch = nullptr;
+    this->flushLog();
+    this->commitGroup();
+}
 
-        size -= byteCount;
+/**
+ * EDIT operation. Writes the pending table log entries to the end of the table log, along with the block count if it
+ * has changed. If the entries don't fit in the log, the tables are compacted into a new snapshot instead. Nothing is
+ * written while a batch or a transaction is open. The writes go through the journal, which is committed once
+ * GROUP_COMMIT_OPERATIONS flushes or GROUP_COMMIT_SIZE bytes have built up.
+ */
+void File::flushLog() {
+    if(this->openBatch != nullptr || this->transaction) // wait for the batch or the transaction to be committed
+        return;
+
+    // fold the log into a new snapshot once it is full
+    uint64_t capacity = static_cast<uint64_t>(this->blockSize) * this->logExtent.length;
+    if(this->pendingLog.getSize() > capacity - this->logSize) {
+        this->writeSnapshot();
+    } else {
+
+        // the log may refer to blocks past the old end of the block list, so they must be counted first
+        if(this->allocator->getBlockCount() != this->diskBlockCount)
+            this->writeBlockCount();
+
+        // append the entries to the log
+        if(this->pendingLog.getSize() > 0) {
+            this->writeAt(this->blockPos(this->logExtent.start) + static_cast<std::streamoff>(this->logSize),
+                          this->pendingLog.getData(), this->pendingLog.getSize());
+            this->logSize += this->pendingLog.getSize();
+            this->pendingLog.clear();
+        }
     }
 
-    // compute a hash digest
-    uint64_t digest = XXH64_digest(state);
+    // commit once enough changes have built up, or the oldest of them has waited long enough
+    if(this->pendingOperations++ == 0)
+        this->groupStart = std::chrono::steady_clock::now();
+    if(this->pendingOperations >= GROUP_COMMIT_OPERATIONS || this->journal->getPendingSize() >= GROUP_COMMIT_SIZE
+       || std::chrono::steady_clock::now() - this->groupStart >= GROUP_COMMIT_INTERVAL)
+        this->commitGroup();
+}
 
-    // clean up
-    delete [] buffer;
-    XXH64_freeState(state);
+/**
+ * EDIT operation. Finds a stored blob whose bytes are identical to a new blob's. Blobs with the same hash and size are
+ * compared a piece at a time, so neither blob needs to be held in memory.
+ *
+ * @param hash The XXH3-64 hash of the new blob's bytes.
+ * @param size The size of the new blob in bytes.
+ * @param bytes The new blob's bytes, or null if they have been written to blocks instead.
+ * @param pending A record describing the new blob's stored bytes, if bytes is null.
+ * @return The identical blob, or null if there is none.
+ */
+BlobRecord* File::findDuplicate(uint64_t hash, uint64_t size, const char* bytes, BlobRecord* pending) {
+    if(size == 0) // empty blobs don't have any blocks to share
+        return nullptr;
+
+    std::vector<char> stored;
+    std::vector<char> added;
+    for(BlobRecord* candidate : this->blobTable->getByHash(hash)) {
+        if(candidate->getHashAlgorithm() != HashAlgorithm::XXHASH3_64 || candidate->getSize() != size)
+            continue;
 
-    return digest;
+        // compare the blobs' bytes
+        bool same = true;
+        for(uint64_t offset = 0; same && offset < size; offset += DEDUP_COMPARE_SIZE) {
+            uint64_t count = std::min(DEDUP_COMPARE_SIZE, size - offset);
+            stored.resize(count);
+            this->readContent(candidate, offset, stored.data(), count);
+            const char* piece;
+            if(bytes != nullptr) {
+                piece = bytes + offset;
+            } else {
+                added.resize(count);
+                this->readContent(pending, offset, added.data(), count);
+                piece = added.data();
+            }
+            same = std::memcmp(stored.data(), piece, count) == 0;
+        }
+        if(same)
+            return candidate;
+    }
 
+    return nullptr;
+}
+
+/**
+ * Copies a name into the arena, where the names of the tables' records are kept next to each other rather than in a
+ * string of their own.
+ *
+ * @param name The name.
+ * @return The copy, which is not null terminated.
+ */
+const char* File::intern(const std::string &name) {
+    return this->arena.copy(name.data(), name.size());
+}
+
+/**
+ * Whether another blob shares a blob's blocks because it was deduplicated. Chunked blobs aren't covered, since the blob
+ * table counts the references to each chunk.
+ *
+ * @param record The record of the blob.
+ */
+bool File::isShared(BlobRecord* record) {
+    const Span<Extent>* extents = record->getExtents();
+    if(extents->empty() || !record->getChunks()->empty())
+        return false;
+    for(BlobRecord* other : this->blobTable->getByHash(record->getHash())) {
+        if(other == record || other->getExtents()->size() != extents->size())
+            continue;
+        if(std::equal(extents->begin(), extents->end(), other->getExtents()->begin(),
+                      [](const Extent &a, const Extent &b) { return a.start == b.start && a.length == b.length; }))
+            return true;
+    }
+    return false;
 }
 
 /**
@@ -847,7 +1522,10 @@ uint64_t File::hash(char* bytes, size_t size) {
  * @param length The number of bytes from the beginning of the file to jump to.
  */
 void File::jump(std::streampos length) {
-    this->stream.seekg(length, this->stream.beg);
+    if(this->mapping != nullptr)
+        this->mappingPos = static_cast<uint64_t>(length);
+    else
+        this->stream.seekg(length, this->stream.beg);
 }
 
 /**
@@ -856,7 +1534,116 @@ void File::jump(std::streampos length) {
  * @param length The number of bytes from the end of the file to jump to.
  */
 void File::jumpBack(std::streampos length) {
-    this->stream.seekg(length, this->stream.end);
+    if(this->mapping != nullptr)
+        this->mappingPos = this->mappingSize + static_cast<std::streamoff>(length);
+    else
+        this->stream.seekg(length, this->stream.end);
+}
+
+/**
+ * Links a blob and a tag together.
+ *
+ * @param blob The blob record.
+ * @param tag The tag record.
+ */
+void File::linkTag(BlobRecord* blob, TagRecord* tag) {
+    blob->addTag(tag, this->arena);
+    tag->addBlob(blob);
+}
+
+/**
+ * EDIT operation. Adds an entry to the pending table log entries. The entries are written by flushLog().
+ *
+ * @param type The type of the entry.
+ * @param payload The entry's payload.
+ */
+void File::logEntry(LogEntryType type, Buffer &payload) {
+    uint64_t start = this->pendingLog.getSize();
+
+    // write the entry's header and payload
+    this->pendingLog.writeUInt8(static_cast<uint8_t>(type));
+    this->pendingLog.writeUInt32(static_cast<uint32_t>(payload.getSize()));
+    this->pendingLog.writeBytes(payload.getData(), payload.getSize());
+
+    // write the entry's checksum, seeded with the log's salt so entries from an older log are never read back
+    this->pendingLog.writeUInt64(XXH64(this->pendingLog.getData() + start, this->pendingLog.getSize() - start,
+                                       this->logSalt));
+}
+
+/**
+ * READ mode operation. Analyzes the file, without locking out a process which is editing it at the same time. The
+ * tables are never rewritten in place, so they can only change under the reader if the table root is moved to new
+ * tables or the table log is appended to. If that happens while they are being read, they are read again.
+ *
+ * @throw Exception The tables could not be read, or kept moving while they were being read.
+ */
+void File::loadTables() {
+    for(unsigned int attempt = 1; ; attempt++) {
+        try {
+            this->analyze();
+            if(!this->tablesMoved(false))
+                return;
+        } catch(Exception &ex) {
+            if(!this->tablesMoved(true))
+                throw;
+        }
+        if(attempt == MAX_LOAD_ATTEMPTS)
+            throw Exception("Tables were moved while they were being read");
+
+        // the new tables may be past the end of the old mapping
+        this->map();
+    }
+}
+
+/**
+ * Finds the records of tags given their names. Tags are case insensitive.
+ *
+ * @param tags The names of the tags.
+ * @return The tags' records, in the same order.
+ * @throw Exception One of the tags does not exist.
+ */
+std::vector<TagRecord*> File::lookupTags(const std::vector<std::string> &tags) {
+    std::vector<TagRecord*> records;
+    for(const auto &tag : tags) {
+
+        // convert tag to lower case
+        std::string tagLower = tag;
+        std::transform(tagLower.begin(), tagLower.end(), tagLower.begin(), ::tolower);
+
+        // get tag record
+        TagRecord* record = this->tagTable->get(tagLower);
+        if(record == nullptr)
+            throw Exception(tagLower + " is not a tag");
+        records.push_back(record);
+    }
+    return records;
+}
+
+/**
+ * READ mode operation. Maps the whole file into memory so that it can be read without a system call for every field.
+ * If the file can't be mapped, it is read through the stream instead.
+ */
+void File::map() {
+    this->unmap();
+
+    // open the file and find its size
+    int fd = ::open(this->filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        return;
+    struct stat info = {};
+    if(fstat(fd, &info) != 0 || info.st_size <= 0) {
+        ::close(fd);
+        return;
+    }
+
+    // map it, the mapping stays valid after the descriptor is closed
+    void* mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED)
+        return;
+    this->mapping = static_cast<const char*>(mapping);
+    this->mappingSize = static_cast<uint64_t>(info.st_size);
+    this->mappingPos = 0;
 }
 
 /**
@@ -865,35 +1652,214 @@ void File::jumpBack(std::streampos length) {
  * @param length The number of bytes to move forward by.
  */
 void File::next(std::streampos length) {
-    this->stream.seekg(length, this->stream.cur);
+    if(this->mapping != nullptr)
+        this->mappingPos += static_cast<std::streamoff>(length);
+    else
+        this->stream.seekg(length, this->stream.cur);
 }
 
 /**
- * Reads a string at the specified position. This function will first read a uint32_t to obtain the length of the
- * string.
+ * Reads bytes from the cursor and moves the cursor past them.
  *
- * @return A string at the cursor's current position.
+ * @param bytes Buffer to read the bytes into.
+ * @param size The number of bytes to read.
+ * @return Whether all of the bytes could be read.
  */
-std::string File::readString() {
-    std::string str;
+bool File::readBytes(char* bytes, uint64_t size) {
+    if(this->mapping != nullptr) {
+        if(this->mappingPos > this->mappingSize || size > this->mappingSize - this->mappingPos)
+            return false;
+        std::memcpy(bytes, this->mapping + this->mappingPos, size);
+        this->mappingPos += size;
+        return true;
+    }
 
-    // read the string into a buffer until a null terminator is reached
-    char current;
-    do {
+    this->stream.read(bytes, static_cast<std::streamsize>(size));
+    return !this->stream.fail();
+}
 
-        // read char from stream
-        this->stream.read(&current, 1);
-        if (this->stream.fail())
-            throw Exception("Failed to read string");
+/**
+ * Reads part of a blob's bytes, decompressing them if needed.
+ *
+ * @param record The record describing the blob's stored bytes.
+ * @param offset The byte offset in the blob to start reading from.
+ * @param bytes Buffer to read the bytes into.
+ * @param size The number of bytes to read.
+ * @throw Exception The bytes could not be read.
+ */
+void File::readContent(BlobRecord* record, uint64_t offset, char* bytes, uint64_t size) {
+    if(record->getCodec() == Codec::UNCOMPRESSED) {
+        this->readExtents(*record->getExtents(), *record->getChunks(), offset, bytes, size);
+        return;
+    }
 
-        // convert char to string and append
-        if (current != '\0') // don't append null terminator, std::string already handles it
-            str += std::string(1, current);
+    // decompress each frame holding part of the bytes
+    const Span<uint32_t>* frames = record->getFrames();
+    uint64_t frameSize = record->getFrameSize();
+    std::vector<char> frame(frameSize);
+    uint64_t storedOffset = 0;
+    for(uint32_t index = 0; size > 0 && index < frames->size(); index++) {
+        uint64_t frameOffset = static_cast<uint64_t>(index) * frameSize;
+        if(offset < frameOffset + frameSize) {
+            uint64_t start = offset - frameOffset;
+            uint64_t count = std::min(size, this->readFrame(record, index, storedOffset, frame.data()) - start);
+            std::memcpy(bytes, frame.data() + start, count);
+            bytes += count;
+            size -= count;
+            offset += count;
+        }
+        storedOffset += (*frames)[index];
+    }
+    if(size > 0)
+        throw Exception("Blob is missing blocks");
+}
 
+/**
+ * Reads part of a blob's bytes from the runs of blocks holding it.
+ *
+ * @param extents The runs of blocks holding the blob.
+ * @param chunks The chunk each run holds if the blob is chunked, otherwise empty.
+ * @param offset The byte offset in the blob to start reading from.
+ * @param bytes Buffer to read the bytes into.
+ * @param size The number of bytes to read.
+ * @throw Exception The bytes could not be read.
+ */
+void File::readExtents(const Span<Extent> &extents, const Span<Chunk> &chunks, uint64_t offset, char* bytes,
+                       uint64_t size) {
+    for(size_t i = 0; i < extents.size(); i++) {
+        const Extent &extent = extents[i];
+        if(size == 0)
+            break;
 
-    } while (current != '\0');
+        // skip the runs before the offset, a chunk only fills part of its run
+        uint64_t runSize = chunks.empty() ? static_cast<uint64_t>(this->blockSize) * extent.length : chunks[i].size;
+        if(offset >= runSize) {
+            offset -= runSize;
+            continue;
+        }
+
+        // read as much of the run as is needed
+        uint64_t count = std::min(size, runSize - offset);
+        this->jump(this->blockPos(extent.start) + static_cast<std::streamoff>(offset));
+        if(!this->readBytes(bytes, count))
+            throw Exception("Failed to read block");
+        bytes += count;
+        size -= count;
+        offset = 0;
+    }
+    if(size > 0)
+        throw Exception("Blob is missing blocks");
+}
+
+/**
+ * Reads a frame of a compressed blob and decompresses it.
+ *
+ * @param record The record describing the blob's stored bytes.
+ * @param index The index of the frame.
+ * @param storedOffset The byte offset of the frame in the blob's stored bytes.
+ * @param bytes Buffer to decompress the frame into, which must hold the blob's frame size.
+ * @return The number of the blob's bytes in the frame.
+ * @throw Exception The frame could not be read or is corrupt.
+ */
+uint64_t File::readFrame(BlobRecord* record, uint32_t index, uint64_t storedOffset, char* bytes) {
+    uint64_t frameOffset = static_cast<uint64_t>(index) * record->getFrameSize();
+    uint64_t size = std::min(static_cast<uint64_t>(record->getFrameSize()), record->getSize() - frameOffset);
+    uint32_t storedSize = (*record->getFrames())[index];
+
+    // a frame which didn't get any smaller was stored as is
+    if(storedSize == size) {
+        this->readExtents(*record->getExtents(), *record->getChunks(), storedOffset, bytes, size);
+        return size;
+    }
+
+    this->frameBuffer.resize(storedSize);
+    this->readExtents(*record->getExtents(), *record->getChunks(), storedOffset, this->frameBuffer.data(), storedSize);
+    if(this->decompressor == nullptr) {
+        this->decompressor = ZSTD_createDCtx();
+        if(this->decompressor == nullptr)
+            throw Exception("Failed to allocate decompression context");
+    }
+    size_t count = ZSTD_decompressDCtx(this->decompressor, bytes, size, this->frameBuffer.data(), storedSize);
+    if(ZSTD_isError(count) || count != size)
+        throw Exception("Blob " + std::to_string(record->getNonce()) + " has a corrupt frame");
+    return size;
+}
+
+/**
+ * READ mode operation. Loads the free map that follows the blob table into the in-memory free block index. The map is
+ * only used if it was written along with the blob table in the snapshot and its checksum matches. Blocks added to the
+ * block list since the snapshot was written are free until the table log says otherwise.
+ *
+ * @param cursor Cursor over the table snapshot, positioned at the start of the free map.
+ * @param blockCount The number of blocks in the block list.
+ * @return Whether the free map was loaded. If false, the free block index must be rebuilt from the tables.
+ */
+bool File::readFreeMap(Cursor &cursor, uint32_t blockCount) {
+    // read the map's header
+    if(cursor.getRemaining() < FREE_MAP_HEADER_SIZE)
+        return false;
+    const char* map = cursor.readBytes(0);
+    uint32_t header[4];
+    cursor.readUInt32s(header, 4);
+
+    // the map is stale if it was not written with the blob table in the snapshot
+    if(header[0] > blockCount || header[1] != this->blobTableNextNonce || header[2] != this->blobTable->size()
+       || header[3] > header[0])
+        return false;
+
+    // read the extents and the checksum
+    uint32_t extentCount = header[3];
+    uint64_t mapSize = FREE_MAP_HEADER_SIZE + static_cast<uint64_t>(FREE_MAP_EXTENT_SIZE) * extentCount;
+    if(cursor.getRemaining() < mapSize - FREE_MAP_HEADER_SIZE + sizeof(uint64_t))
+        return false;
+    std::vector<uint32_t> extents(static_cast<size_t>(extentCount) * 2);
+    cursor.readUInt32s(extents.data(), extents.size());
+    uint64_t checksum = cursor.readUInt64();
+    if(checksum != XXH64(map, mapSize, MAGIC_NUMBER))
+        return false;
+
+    // build the free block index from the extents
+    delete this->allocator;
+    this->allocator = new BlockAllocator(header[0]);
+    this->allocator->use(0, header[0]);
+    for(size_t i = 0; i < extents.size(); i += 2)
+        this->allocator->free(extents[i], extents[i + 1]);
+    this->allocator->grow(blockCount);
+
+    return true;
+}
 
-    return str;
+/**
+ * READ mode operation. Gets a region of the file into memory so that it can be parsed without reading each field from
+ * the file. If the file is mapped, the cursor points straight into the mapping. Otherwise, the region is read into a
+ * buffer with a single read. The region is cut short if the file ends before it does.
+ *
+ * @param start The position of the start of the region.
+ * @param size The size of the region in bytes.
+ * @param buffer Buffer to read the region into if the file isn't mapped. It must outlive the returned cursor.
+ * @return A cursor at the start of the region.
+ * @throw Exception The region could not be read.
+ */
+Cursor File::readRegion(std::streampos start, uint64_t size, std::vector<char> &buffer) {
+    auto offset = static_cast<uint64_t>(start);
+
+    // point into the mapping
+    if(this->mapping != nullptr) {
+        if(offset > this->mappingSize)
+            throw Exception("Failed to read tables");
+        return Cursor(this->mapping + offset, std::min(size, this->mappingSize - offset));
+    }
+
+    // find the size of the file, then read the region in one go
+    this->jumpBack(0);
+    auto end = static_cast<uint64_t>(this->tell());
+    this->jump(start);
+    if(this->stream.fail() || offset > end)
+        throw Exception("Failed to read tables");
+    buffer.resize(std::min(size, end - offset));
+    if(!this->readBytes(buffer.data(), buffer.size()))
+        throw Exception("Failed to read tables");
+    return Cursor(buffer.data(), buffer.size());
 }
 
 /**
@@ -903,123 +1869,347 @@ std::string File::readString() {
  */
 uint32_t File::readUInt32() {
     uint32_t value;
-    this->stream.read(reinterpret_cast<char*>(&value), sizeof(uint32_t));
-    if(this->stream.fail())
+    if(!this->readBytes(reinterpret_cast<char*>(&value), sizeof(uint32_t)))
         throw Exception("Failed to read uint32");
     return ntohl(value);
 }
 
 /**
- * Reads a uint64_t from the file and moves the cursor forward by 4 bytes.
+ * Finds the records of the blobs in a bitmap of nonces.
  *
- * @return The uint64_t value from the file.
+ * @param nonces The nonces of the blobs.
+ * @return The blobs' records, in ascending order of nonce.
  */
-uint64_t File::readUInt64() {
-    uint64_t value;
-    this->stream.read(reinterpret_cast<char*>(&value), sizeof(uint64_t));
-    if(this->stream.fail())
-        throw Exception("Failed to read uint64");
-    return be64toh(value);
+std::vector<BlobRecord*> File::recordsFor(const Bitmap &nonces) {
+    std::vector<BlobRecord*> records;
+    records.reserve(nonces.size());
+    for(uint32_t nonce : nonces.values()) {
+        BlobRecord* record = this->blobTable->get(nonce);
+        if(record != nullptr)
+            records.push_back(record);
+    }
+    return records;
 }
 
 /**
- * Closes the file stream, resets all flags, and changes the operation mode to CLOSED.
+ * Returns a run of blocks to the free block index. In EDIT mode, the blocks are held until the journal is committed,
+ * since the tables on disk still point to them until then.
+ *
+ * @param extent The run of blocks.
+ * @param overwrite Whether the blocks' data should be overwritten with zeroes before they are freed.
  */
-void File::reset() {
-    this->stream.close();
-    this->stream.clear();
-    this->op = FileMode::CLOSED;
+void File::releaseBlocks(const Extent &extent, bool overwrite) {
+    if(extent.length == 0)
+        return;
+    if(this->op != FileMode::EDIT) {
+        this->allocator->free(extent.start, extent.length);
+        return;
+    }
+    this->pendingFree.push_back(extent);
+    if(overwrite)
+        this->pendingZero.push_back(extent);
 }
 
 /**
- * INTERNAL operation. Writes the current blob table from memory to the file at the *current position*. This will update
- * the blob table's position variable.
+ * EDIT operation. Reads the tables again, under the journal's lock so that they can't change while they are read.
+ * Blobs deleted by the table log were overwritten when their deletion was committed, so their blocks are freed as the
+ * log is replayed. Blocks released by mutations which haven't been committed yet are still held until they are.
+ *
+ * @throw Exception The tables could not be read.
  */
-void File::writeBlobTable() {
+void File::reloadTables() {
+    this->analyze();
+}
 
-    // update blob table position
-    this->blobTablePos = this->stream.tellg();
+/**
+ * Removes a blob from the in-memory tables and returns its blocks to the free block index if it has been loaded and
+ * no other blob shares them. Tags which are no longer attached to any blob are removed too. The records stay in the
+ * arena until the tables are read again.
+ *
+ * @param record The record of the blob.
+ * @param committed Whether the deletion is already committed, as it is when replayed from the table log. Its blocks
+ *                  are then freed at once, so that a blob added later in the log can take them. Otherwise they are
+ *                  released like any other blocks.
+ */
+void File::removeBlob(BlobRecord* record, bool committed) {
+    bool shared = this->isShared(record);
 
-    // update next nonce
-    this->writeUInt32(this->blobTableNextNonce);
+    // remove blob record from tag records
+    for(TagRecord* tagRecord : *record->getTags()) {
 
-    // write blob count
-    this->writeUInt32(this->blobTable->size());
+        // delete the link from tag -> blob
+        if(!tagRecord->removeBlob(record))
+            continue;
 
-    // rewrite blob table entries
-    for(auto &iter : *this->blobTable) {
-        BlobRecord* row = iter.second;
+        // no more blobs left in tag, delete the tag
+        if(tagRecord->getBlobs()->empty()) {
+            this->tagTable->remove(tagRecord);
+            this->arena.discard(tagRecord->getArenaSize());
+        }
+    }
 
-        // write nonce
-        this->writeUInt32(row->getNonce());
+    // remove blob record from blob table, which also drops the chunks no other blob contains
+    std::vector<Extent> unusedChunks = this->blobTable->remove(record);
 
-        // write name
-        this->writeString(row->getName());
+    // return the blob's blocks to the free block index, unless a deduplicated blob still uses them
+    auto release = [this, committed](const Extent &extent) {
+        if(committed && extent.length > 0)
+            this->allocator->free(extent.start, extent.length);
+        else if(!committed)
+            this->releaseBlocks(extent, true);
+    };
+    if(this->allocator != nullptr) {
+        if(!record->getChunks()->empty()) {
+            for(const Extent &extent : unusedChunks)
+                release(extent);
+        } else if(!shared) {
+            for(const Extent &extent : *record->getExtents())
+                release(extent);
+        }
+    }
+    this->arena.discard(record->getArenaSize());
+}
 
-        // write hash
-        this->writeUInt64(row->getHash());
+/**
+ * READ mode operation. Applies the entries in the table log to the in-memory tables. Reading stops at the first entry
+ * which is incomplete, whose checksum doesn't match, or which was appended after the block list was read, since that
+ * is where the log ends.
+ *
+ * @param cursor Cursor over the table log.
+ */
+void File::replayLog(Cursor &cursor) {
+    this->logSize = 0;
+    while(cursor.getRemaining() >= LOG_ENTRY_HEADER_SIZE + LOG_ENTRY_CHECKSUM_SIZE) {
+
+        // read the entry's header
+        const char* entry = cursor.readBytes(0);
+        uint8_t type = cursor.readUInt8();
+        uint32_t length = cursor.readUInt32();
+        if(type == 0 || length > cursor.getRemaining() - LOG_ENTRY_CHECKSUM_SIZE)
+            break;
 
-        // write start pos
-        this->writeUInt64(static_cast<uint64_t>(row->getStart()));
+        // check the entry's checksum
+        const char* payload = cursor.readBytes(length);
+        uint64_t checksum = cursor.readUInt64();
+        if(checksum != XXH64(entry, LOG_ENTRY_HEADER_SIZE + length, this->logSalt))
+            break;
 
-        // write size
-        this->writeUInt64(row->getSize());
+        // apply the entry
+        Cursor payloadCursor(payload, length);
+        if(!this->applyLogEntry(type, payloadCursor))
+            break;
+        this->logSize += LOG_ENTRY_HEADER_SIZE + length + LOG_ENTRY_CHECKSUM_SIZE;
 
-        // write tag count
-        this->writeUInt32(static_cast<uint32_t >(row->getTags()->size()));
+    }
+}
 
-        // write each tag's nonce
-        for(auto tag : *row->getTags())
-            this->writeUInt32(tag->getNonce());
+/**
+ * READ mode operation. Checks whether the tables which were last read are still the tables in the file. They aren't if
+ * the table root has been moved. Entries appended to the table log may also refer to blocks which were added to the
+ * block list after its size was read, which only matters if reading the tables failed.
+ *
+ * @param checkBlockCount Whether the tables count as changed if the block list has grown.
+ * @return True if the tables have changed or the header can't be read.
+ */
+bool File::tablesMoved(bool checkBlockCount) {
+    char root[28];
+    this->jump(this->headerPos + static_cast<std::streamoff>(MAGIC_NUMBER_LEN + FILE_VERSION_LEN + BLOCK_SIZE_LEN
+                                                            + DEK_LEN));
+    if(!this->readBytes(root, TABLE_ROOT_LEN + BLOCK_LIST_COUNT_SIZE)) {
+        this->stream.clear();
+        return true;
     }
 
-    // flush the stream
-    this->stream.flush();
+    Cursor cursor(root, TABLE_ROOT_LEN + BLOCK_LIST_COUNT_SIZE);
+    return cursor.readUInt32() != this->snapshotExtent.start || cursor.readUInt32() != this->snapshotExtent.length
+           || cursor.readUInt32() != this->logExtent.start || cursor.readUInt32() != this->logExtent.length
+           || cursor.readUInt64() != this->logSalt
+           || (checkBlockCount && cursor.readUInt32() != this->diskBlockCount);
 }
 
 /**
- * Writes a string to the file at the current position and moves the cursor forward by a number of bytes equal to the
- * length of the string.
+ * Checks whether the tables in memory are still the tables in the file, without reading them again. Another
+ * process can only have changed them by moving the table root, growing the block list, or appending to the table log,
+ * in which case a valid entry follows the end of the log as it was last read or written.
  *
- * @param value The string to write.
+ * @return True if the tables must be read again.
  */
-void File::writeString(const std::string &value) {
+bool File::tablesStale() {
+    if(!this->tablesLoaded || this->tablesMoved(true))
+        return true;
+
+    // no other entry fits in the log
+    uint64_t room = static_cast<uint64_t>(this->blockSize) * this->logExtent.length - this->logSize;
+    if(room < LOG_ENTRY_HEADER_SIZE + LOG_ENTRY_CHECKSUM_SIZE)
+        return false;
+
+    // read the header of the entry which would come next
+    std::vector<char> entry(LOG_ENTRY_HEADER_SIZE);
+    this->jump(this->blockPos(this->logExtent.start) + static_cast<std::streamoff>(this->logSize));
+    if(!this->readBytes(entry.data(), LOG_ENTRY_HEADER_SIZE)) {
+        this->stream.clear();
+        return true;
+    }
+    Cursor header(entry.data(), LOG_ENTRY_HEADER_SIZE);
+    uint8_t type = header.readUInt8();
+    uint32_t length = header.readUInt32();
+    if(type == 0 || length > room - LOG_ENTRY_HEADER_SIZE - LOG_ENTRY_CHECKSUM_SIZE)
+        return false;
+
+    // leftover bytes from an older log never match a checksum seeded with the current salt
+    entry.resize(LOG_ENTRY_HEADER_SIZE + length + LOG_ENTRY_CHECKSUM_SIZE);
+    if(!this->readBytes(entry.data() + LOG_ENTRY_HEADER_SIZE, length + LOG_ENTRY_CHECKSUM_SIZE)) {
+        this->stream.clear();
+        return true;
+    }
+    Cursor checksum(entry.data() + LOG_ENTRY_HEADER_SIZE + length, LOG_ENTRY_CHECKSUM_SIZE);
+    return checksum.readUInt64() == XXH64(entry.data(), LOG_ENTRY_HEADER_SIZE + length, this->logSalt);
+}
 
-    // write string bytes
-    this->stream.write(value.c_str(), value.size() + 1); // + 1 for null terminator
-    if(this->stream.fail())
-        throw Exception("Failed to write string");
+/**
+ * Closes the file stream, resets all flags, and changes the operation mode to CLOSED.
+ */
+void File::reset() {
+    this->unmap();
+    this->stream.close();
+    this->stream.clear();
+    this->op = FileMode::CLOSED;
 }
 
 /**
- * INTERNAL operation. Writes the current tag table from memory to the file at the *current position*. This will update
- * the tag table's position variable. This may overwrite parts of the blob table, so ensure you rewrite it afterward.
+ * Returns the position of the cursor from the beginning of the file.
  */
-void File::writeTagTable() {
+std::streampos File::tell() {
+    if(this->mapping != nullptr)
+        return static_cast<std::streamoff>(this->mappingPos);
+    return this->stream.tellg();
+}
 
-    // update tag table position
-    this->tagTablePos = this->stream.tellg();
+/**
+ * Unmaps the file from memory if it was mapped.
+ */
+void File::unmap() {
+    if(this->mapping == nullptr)
+        return;
+    munmap(const_cast<char*>(this->mapping), static_cast<size_t>(this->mappingSize));
+    this->mapping = nullptr;
+    this->mappingSize = 0;
+    this->mappingPos = 0;
+}
 
-    // write next nonce
-    this->writeUInt32(this->tagTableNextNonce);
+/**
+ * Writes raw bytes to the tables or header at a position in the file. In EDIT mode, the write is added to the journal
+ * and made when the journal is committed.
+ *
+ * @param pos The position in the file to write at.
+ * @param bytes Pointer to the bytes to write.
+ * @param size The number of bytes to write.
+ */
+void File::writeAt(std::streampos pos, const char* bytes, uint64_t size) {
+    if(this->op == FileMode::EDIT) {
+        this->journal->add(static_cast<uint64_t>(pos), bytes, size);
+        return;
+    }
+    this->jump(pos);
+    this->writeBytes(bytes, size);
+}
 
-    // write tag count
-    this->writeUInt32(this->tagTable->size());
+/**
+ * EDIT operation. Writes the number of blocks in the block list.
+ */
+void File::writeBlockCount() {
+    uint32_t count = htobe32(this->allocator->getBlockCount());
+    this->writeAt(this->blockListPos, reinterpret_cast<char*>(&count), sizeof(uint32_t));
+    this->diskBlockCount = this->allocator->getBlockCount();
+}
+
+/**
+ * Writes raw bytes to the file at the current position and moves the cursor forward past them.
+ *
+ * @param bytes Pointer to the bytes to write.
+ * @param size The number of bytes to write.
+ */
+void File::writeBytes(const char* bytes, uint64_t size) {
+    this->stream.write(bytes, static_cast<std::streamsize>(size));
+    if(this->stream.fail())
+        throw Exception("Failed to write to the file");
+}
 
-    // rewrite tag table entries
-    for(auto &iter : *this->tagTable) {
-        TagRecord* row = iter.second;
+/**
+ * EDIT operation. Writes the table root, which locates the table snapshot and the table log, into the header.
+ */
+void File::writeRoot() {
+    Buffer root;
+    root.writeUInt32(this->snapshotExtent.start);
+    root.writeUInt32(this->snapshotExtent.length);
+    root.writeUInt32(this->logExtent.start);
+    root.writeUInt32(this->logExtent.length);
+    root.writeUInt64(this->logSalt);
+
+    this->writeAt(this->headerPos + static_cast<std::streamoff>(MAGIC_NUMBER_LEN + FILE_VERSION_LEN + BLOCK_SIZE_LEN
+                                                                 + DEK_LEN), root.getData(), root.getSize());
+}
 
-        // write nonce
-        this->writeUInt32(row->getNonce());
+/**
+ * EDIT operation. Compacts the tables by writing the in-memory tables out as a new snapshot and starting an empty
+ * table log. The snapshot and the log are always written to free blocks and the table root is written last, so the
+ * old tables stay whole until the root points away from them. A reader which loads the tables while they are being
+ * rewritten sees the root change and loads them again. The log is given a capacity of at least the size of the
+ * snapshot, so that compaction costs no more than the appends that led up to it.
+ */
+void File::writeSnapshot() {
+
+    // the pending entries are folded into the snapshot
+    this->pendingLog.clear();
 
-        // write name length and name
-        this->writeString(row->getName());
+    // the old tables are no longer needed once the root points to the new ones
+    this->releaseBlocks(this->logExtent, false);
+    this->releaseBlocks(this->snapshotExtent, false);
 
+    // build the tables
+    Buffer tables;
+    this->encodeTables(tables);
+    uint64_t tablesSize = tables.getSize();
+
+    // once most of the arena is held by records which have been removed, the tables are read back from the snapshot,
+    // which leaves the arena and the indexes holding only what is still in use
+    if(this->arena.getWasted() > this->arena.getUsed() / 2) {
+        Cursor cursor(tables.getData(), tablesSize);
+        this->decodeTables(cursor);
     }
 
-    // flush the stream
-    this->stream.flush();
+    // find room for the snapshot, allowing for the free map to gain a few extents from allocating the tables' blocks
+    uint64_t snapshotSize = tablesSize + FREE_MAP_HEADER_SIZE + sizeof(uint64_t)
+                            + FREE_MAP_EXTENT_SIZE * (this->allocator->getExtents()->size()
+                                                      + this->pendingFree.size() + 4);
+    this->snapshotExtent = this->allocator->allocateRun(this->blocksFor(snapshotSize));
+
+    // find room for the log
+    this->logExtent = this->allocator->allocateRun(this->blocksFor(std::max(MIN_LOG_SIZE, tablesSize)));
+
+    // the free map goes last, since it has to include the tables' blocks
+    this->encodeFreeMap(tables);
+    if(tables.getSize() > static_cast<uint64_t>(this->blockSize) * this->snapshotExtent.length)
+        throw Exception("Table snapshot is larger than its blocks");
+
+    // write the snapshot
+    this->writeAt(this->blockPos(this->snapshotExtent.start), tables.getData(), tables.getSize());
+
+    // start an empty log with a new salt, marking its end with an empty entry and making sure all of its blocks exist
+    this->logSalt++;
+    this->logSize = 0;
+    char zeroes[8] = { };
+    this->writeAt(this->blockPos(this->logExtent.start), zeroes, LOG_ENTRY_HEADER_SIZE);
+    this->writeAt(this->blockPos(this->logExtent.start + this->logExtent.length) - static_cast<std::streamoff>(1),
+                  zeroes, 1);
+
+    // point the header at the new tables once the block list holds them. In EDIT mode, the root is written when the
+    // group is committed, so that it comes after every other write in the group
+    this->writeBlockCount();
+    if(this->op == FileMode::EDIT)
+        this->rootPending = true;
+    else
+        this->writeRoot();
 }
 
 /**
@@ -1034,14 +2224,3 @@ void File::writeUInt32(const uint32_t &value) {
         throw Exception("Failed to write uint32");
 }
 
-/**
- * Writes a uint64_t to the file at the current position and moves the cursor forward by 8 bytes.
- *
- * @param value The uint64_t value to write.
- */
-void File::writeUInt64(const uint64_t &value) {
-    uint64_t networkByteValue = htobe64(value);
-    this->stream.write((char*) &networkByteValue, sizeof(uint64_t));
-    if(this->stream.fail())
-        throw Exception("Failed to write uint64");
-}
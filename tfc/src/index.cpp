@@ -0,0 +1,117 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <tfc/exception.h>
+#include <tfc/index.h>
+
+using namespace Tfc;
+
+const uint32_t HashIndex::EMPTY;
+const uint32_t HashIndex::REMOVED;
+const size_t HashIndex::MIN_SLOTS;
+
+/**
+ * Adds a value under a key. The same value can be added under a key more than once.
+ *
+ * @param key The key.
+ * @param value The value.
+ * @throw Exception The value is EMPTY or REMOVED.
+ */
+void HashIndex::insert(uint64_t key, uint32_t value) {
+    if(value >= REMOVED)
+        throw Exception("Value " + std::to_string(value) + " can't be indexed");
+
+    // keep at least a third of the slots empty, so that probes stay short
+    if((this->used + 1) * 3 > this->values.size() * 2)
+        this->rehash(this->count + 1);
+
+    size_t mask = this->values.size() - 1;
+    size_t slot = this->home(key);
+    while(this->values[slot] != EMPTY && this->values[slot] != REMOVED)
+        slot = (slot + 1) & mask;
+    if(this->values[slot] == EMPTY)
+        this->used++;
+    this->keys[slot] = key;
+    this->values[slot] = value;
+    this->count++;
+}
+
+/**
+ * Removes a value from under a key.
+ *
+ * @param key The key.
+ * @param value The value.
+ * @return Whether the value was held under the key.
+ */
+bool HashIndex::remove(uint64_t key, uint32_t value) {
+    if(this->values.empty())
+        return false;
+    size_t mask = this->values.size() - 1;
+    for(size_t slot = this->home(key); this->values[slot] != EMPTY; slot = (slot + 1) & mask) {
+        if(this->keys[slot] == key && this->values[slot] == value) {
+            this->values[slot] = REMOVED;
+            this->count--;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Makes room for a number of entries, so that adding them doesn't rehash the index one step at a time.
+ *
+ * @param count The number of entries.
+ */
+void HashIndex::reserve(size_t count) {
+    if(count * 3 > this->values.size() * 2)
+        this->rehash(count);
+}
+
+/**
+ * Returns the slot a key is probed from. Keys such as block numbers aren't random, so they are mixed first.
+ *
+ * @param key The key.
+ */
+size_t HashIndex::home(uint64_t key) const {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    return static_cast<size_t>(key) & (this->values.size() - 1);
+}
+
+/**
+ * Moves the entries into new arrays of slots, at least twice as many as a number of entries, dropping the removed
+ * slots.
+ *
+ * @param count The number of entries the new slots must have room for.
+ */
+void HashIndex::rehash(size_t count) {
+    size_t size = MIN_SLOTS;
+    while(size < count * 2)
+        size *= 2;
+
+    std::vector<uint64_t> oldKeys(size);
+    std::vector<uint32_t> oldValues(size, EMPTY);
+    oldKeys.swap(this->keys);
+    oldValues.swap(this->values);
+    this->count = 0;
+    this->used = 0;
+    for(size_t slot = 0; slot < oldValues.size(); slot++) {
+        if(oldValues[slot] != EMPTY && oldValues[slot] != REMOVED)
+            this->insert(oldKeys[slot], oldValues[slot]);
+    }
+}
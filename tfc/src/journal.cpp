@@ -15,10 +15,26 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <xxhash/xxhash.h>
+#include <tfc/buffer.h>
+#include <tfc/cursor.h>
+#include <tfc/exception.h>
 #include <tfc/journal.h>
 
 using namespace Tfc;
 
+/**
+ * Creates a new representation of a Tagged File Journal (TFJ) file. The journal is a write-ahead log for a container:
+ * writes to the container's tables are collected into groups, and each group is written to the journal and flushed to
+ * disk before any of it is written to the container. If the process dies while a group is being written to the
+ * container, the group is replayed the next time the container is opened for editing.
+ *
+ * @param filename The path of the journal on the disk
+ */
 Journal::Journal(const std::string &filename) {
     this->filename = filename;
 
@@ -27,3 +43,283 @@ Journal::Journal(const std::string &filename) {
     this->exists = stream.good();
 
 }
+
+/**
+ * Destroys the representation of the journal, releasing its lock. Writes which haven't been committed are lost.
+ */
+Journal::~Journal() {
+    this->close();
+}
+
+/**
+ * Adds a write to the current group. Nothing is written until the group is committed. A write to the same place as an
+ * earlier write in the group replaces it unless a later write overlaps it, and a write which starts where the last one
+ * ended is merged into it.
+ *
+ * @param start The position in the container to write at.
+ * @param bytes Pointer to the bytes to write.
+ * @param size The number of bytes to write.
+ */
+void Journal::add(uint64_t start, const char* bytes, uint64_t size) {
+    this->pendingSize += size;
+
+    // merge with the last write if it can be extended
+    if(!this->operations.empty()) {
+        JournalOperation &last = this->operations.back();
+        if(last.start + last.data.size() == start) {
+            last.data.insert(last.data.end(), bytes, bytes + size);
+            return;
+        }
+    }
+
+    // replace the latest write to the same place, as long as no later write overlaps it
+    for(auto operation = this->operations.rbegin(); operation != this->operations.rend(); operation++) {
+        if(operation->start >= start + size || operation->start + operation->data.size() <= start)
+            continue;
+        if(operation->start == start && operation->data.size() == size) {
+            this->pendingSize -= size;
+            operation->data.assign(bytes, bytes + size);
+            return;
+        }
+        break;
+    }
+
+    this->operations.push_back({ start, std::vector<char>(bytes, bytes + size) });
+}
+
+/**
+ * Commits the current group, then flushes the container to disk and empties the journal, since nothing in it will
+ * need to be replayed. Used when editing ends.
+ *
+ * @param container The container's stream.
+ */
+void Journal::checkpoint(std::fstream &container) {
+    if(this->fd < 0)
+        return;
+    this->commit(container);
+
+    // everything in the journal is in the container now
+    container.flush();
+    if(fsync(this->containerFd) != 0)
+        throw Exception("Failed to flush the container to disk");
+    if(ftruncate(this->fd, 0) != 0 || fsync(this->fd) != 0)
+        throw Exception("Failed to empty the journal");
+}
+
+/**
+ * Closes the journal, releasing its lock. Writes which haven't been committed are lost.
+ */
+void Journal::close() {
+    if(this->fd >= 0)
+        ::close(this->fd);
+    if(this->containerFd >= 0)
+        ::close(this->containerFd);
+    this->fd = -1;
+    this->containerFd = -1;
+    this->operations.clear();
+    this->pendingSize = 0;
+}
+
+/**
+ * Commits the current group. The container is flushed to disk first so that any blocks the group's tables point to are
+ * there, then the group is written to the journal and flushed to disk with a single sync, and then it is written to
+ * the container. The container isn't flushed again until the next group is committed, since the journal can replay it.
+ *
+ * @param container The container's stream.
+ * @throw Exception The group could not be committed.
+ */
+void Journal::commit(std::fstream &container) {
+    if(this->operations.empty())
+        return;
+    if(this->fd < 0)
+        throw Exception("Journal is not open");
+
+    // make sure the blocks the group points to are on disk
+    container.flush();
+    if(container.fail() || fsync(this->containerFd) != 0)
+        throw Exception("Failed to flush the container to disk");
+
+    // write the group to the journal
+    this->write(this->operations);
+
+    // make the writes in the container
+    for(const JournalOperation &operation : this->operations) {
+        container.seekp(static_cast<std::streamoff>(operation.start), container.beg);
+        container.write(operation.data.data(), static_cast<std::streamsize>(operation.data.size()));
+        if(container.fail())
+            throw Exception("Failed to write journaled changes to the container");
+    }
+    container.flush();
+    this->operations.clear();
+    this->pendingSize = 0;
+}
+
+/**
+ * Throws away the current group and empties the journal. Used when the container is overwritten with a new one.
+ */
+void Journal::discard() {
+    this->operations.clear();
+    this->pendingSize = 0;
+    if(this->fd >= 0) {
+        if(ftruncate(this->fd, 0) != 0)
+            throw Exception("Failed to empty the journal");
+    } else if(this->exists) {
+        if(truncate(this->filename.c_str(), 0) != 0)
+            throw Exception("Failed to empty the journal");
+    }
+}
+
+/**
+ * Opens the journal for editing the container. The journal is locked, so only one process can edit the container at a
+ * time. If the last process to edit the container didn't finish, its last committed group is replayed.
+ *
+ * @param containerFilename The path of the container on the disk.
+ * @throw Exception The journal couldn't be opened or another process is editing the container.
+ */
+void Journal::open(const std::string &containerFilename) {
+    if(this->fd >= 0)
+        return;
+
+    // open and lock the journal
+    this->fd = ::open(this->filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if(this->fd < 0)
+        throw Exception("Failed to open the journal");
+    this->exists = true;
+    if(!this->lock(this->fd)) {
+        this->close();
+        throw Exception("Container is being edited by another process");
+    }
+
+    // open the container so it can be flushed to disk
+    this->containerFd = ::open(containerFilename.c_str(), O_RDWR);
+    if(this->containerFd < 0) {
+        this->close();
+        throw Exception("Failed to open for editing");
+    }
+
+    // replay the last group if it might not have been written to the container
+    try {
+        this->replay();
+    } catch(Exception &ex) {
+        this->close();
+        throw;
+    }
+}
+
+/*
+ * ----------------
+ * PRIVATE METHODS
+ * ----------------
+ */
+
+/**
+ * Locks a journal file for this process without waiting.
+ *
+ * @param fd The journal file.
+ * @return Whether the lock was taken.
+ */
+bool Journal::lock(int fd) {
+    return flock(fd, LOCK_EX | LOCK_NB) == 0;
+}
+
+/**
+ * Reads a committed group from a journal file.
+ *
+ * @param fd The journal file.
+ * @param operations Set to the group's writes.
+ * @return Whether the journal holds a whole committed group.
+ */
+bool Journal::read(int fd, std::vector<JournalOperation> &operations) {
+
+    // read the whole journal
+    struct stat info = {};
+    if(fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(HEADER_SIZE))
+        return false;
+    std::vector<char> bytes(static_cast<size_t>(info.st_size));
+    if(pread(fd, bytes.data(), bytes.size(), 0) != static_cast<ssize_t>(bytes.size()))
+        return false;
+
+    try {
+        Cursor cursor(bytes.data(), bytes.size());
+
+        // check the header
+        if(cursor.readUInt32() != MAGIC_NUMBER || cursor.readUInt32() != FILE_VERSION
+           || cursor.readUInt8() != JournalState::COMMITTED)
+            return false;
+
+        // read the operations
+        const char* list = cursor.readBytes(0);
+        uint32_t count = cursor.readUInt32();
+        if(static_cast<uint64_t>(count) * OPERATION_HEADER_SIZE > cursor.getRemaining())
+            return false;
+        operations.clear();
+        for(uint32_t i = 0; i < count; i++) {
+            if(cursor.readUInt8() != JournalState::COMMITTED)
+                return false;
+            uint64_t start = cursor.readUInt64();
+            uint64_t size = cursor.readUInt64();
+            const char* data = cursor.readBytes(size);
+            operations.push_back({ start, std::vector<char>(data, data + size) });
+        }
+
+        // the group is only whole if its checksum matches
+        uint64_t listSize = static_cast<uint64_t>(cursor.readBytes(0) - list);
+        if(cursor.readUInt64() != XXH64(list, listSize, MAGIC_NUMBER))
+            return false;
+    } catch(Exception &ex) { // the group was cut short
+        return false;
+    }
+
+    return !operations.empty();
+}
+
+/**
+ * Writes the committed group in the journal to the container, if there is one, then empties the journal. Writing the
+ * group again is harmless, so it doesn't matter whether it was written before.
+ *
+ * @throw Exception The group could not be written.
+ */
+void Journal::replay() {
+    std::vector<JournalOperation> committed;
+    if(!this->read(this->fd, committed))
+        return;
+    for(const JournalOperation &operation : committed) {
+        auto size = static_cast<ssize_t>(operation.data.size());
+        if(pwrite(this->containerFd, operation.data.data(), operation.data.size(), static_cast<off_t>(operation.start))
+           != size)
+            throw Exception("Failed to replay the journal");
+    }
+    if(fsync(this->containerFd) != 0 || ftruncate(this->fd, 0) != 0 || fsync(this->fd) != 0)
+        throw Exception("Failed to replay the journal");
+}
+
+/**
+ * Writes a group to the journal as committed and flushes it to disk.
+ *
+ * @param operations The group's writes.
+ * @throw Exception The group could not be written.
+ */
+void Journal::write(const std::vector<JournalOperation> &operations) {
+    Buffer buffer;
+
+    // write the header
+    buffer.writeUInt32(MAGIC_NUMBER);
+    buffer.writeUInt32(FILE_VERSION);
+    buffer.writeUInt8(JournalState::COMMITTED);
+
+    // write the operations
+    uint64_t listStart = buffer.getSize();
+    buffer.writeUInt32(static_cast<uint32_t>(operations.size()));
+    for(const JournalOperation &operation : operations) {
+        buffer.writeUInt8(JournalState::COMMITTED);
+        buffer.writeUInt64(operation.start);
+        buffer.writeUInt64(operation.data.size());
+        buffer.writeBytes(operation.data.data(), operation.data.size());
+    }
+    buffer.writeUInt64(XXH64(buffer.getData() + listStart, buffer.getSize() - listStart, MAGIC_NUMBER));
+
+    // write the journal in one go and flush it to disk
+    if(pwrite(this->fd, buffer.getData(), buffer.getSize(), 0) != static_cast<ssize_t>(buffer.getSize())
+       || ftruncate(this->fd, static_cast<off_t>(buffer.getSize())) != 0 || fsync(this->fd) != 0)
+        throw Exception("Failed to write the journal");
+}
@@ -0,0 +1,426 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cctype>
+#include <tfc/file.h>
+#include <tfc/query.h>
+
+using namespace Tfc;
+
+/**
+ * Parses and plans a query. Use File::query() to create one.
+ *
+ * @param file The file whose blobs are searched.
+ * @param expression Tags joined by AND, OR and NOT, grouped with parentheses. Tags next to each other must both match.
+ *                   A tag which doesn't exist matches no blobs.
+ * @throw Exception The expression is malformed.
+ */
+BlobQuery::BlobQuery(File* file, const std::string &expression) {
+    this->file = file;
+
+    this->tokenize(expression);
+    if(this->tokens.empty())
+        throw Exception("Query is empty");
+    Node* parsed = this->parseOr();
+    if(this->token < this->tokens.size())
+        throw Exception("Unexpected " + this->tokens[this->token] + " in query");
+
+    this->root = this->plan(parsed);
+}
+
+/**
+ * READ operation. Finds every remaining result of the query.
+ *
+ * @return The blobs, in ascending order of nonce.
+ */
+std::vector<BlobRecord*> BlobQuery::all() {
+    std::vector<BlobRecord*> records;
+    for(BlobRecord* record = this->next(); record != nullptr; record = this->next())
+        records.push_back(record);
+    return records;
+}
+
+/**
+ * READ operation. Finds the next result of the query. Only as much of the query is evaluated as is needed to find
+ * it, so the first results are returned without the rest being computed.
+ *
+ * @return The next matching blob, or null if there are no more.
+ */
+BlobRecord* BlobQuery::next() {
+    if(this->file->op != FileMode::READ)
+        throw Exception("File not in READ mode");
+
+    while(!this->done) {
+        uint32_t nonce;
+        if(!this->seek(this->root, this->position, nonce)) {
+            this->done = true;
+            break;
+        }
+        if(nonce == UINT32_MAX)
+            this->done = true;
+        else
+            this->position = nonce + 1;
+
+        // tags can hold the nonces of blobs which have been deleted
+        BlobRecord* record = this->file->blobTable->get(nonce);
+        if(record != nullptr)
+            return record;
+    }
+    return nullptr;
+}
+
+/**
+ * Adds a node to the query.
+ *
+ * @param type The kind of node.
+ * @return The node, which lives as long as the query.
+ */
+BlobQuery::Node* BlobQuery::node(NodeType type) {
+    this->nodes.emplace_back();
+    Node* node = &this->nodes.back();
+    node->type = type;
+    return node;
+}
+
+/**
+ * Parses terms joined by AND, or simply written next to each other.
+ */
+BlobQuery::Node* BlobQuery::parseAnd() {
+    Node* left = this->parseUnary();
+    while(this->token < this->tokens.size() && this->tokens[this->token] != "OR" && this->tokens[this->token] != ")") {
+        if(this->tokens[this->token] == "AND")
+            this->token++;
+        Node* right = this->parseUnary();
+        if(left->type != NodeType::AND) {
+            Node* conjunction = this->node(NodeType::AND);
+            conjunction->children.push_back(left);
+            left = conjunction;
+        }
+        left->children.push_back(right);
+    }
+    return left;
+}
+
+/**
+ * Parses terms joined by OR. OR binds more loosely than AND.
+ */
+BlobQuery::Node* BlobQuery::parseOr() {
+    Node* left = this->parseAnd();
+    while(this->token < this->tokens.size() && this->tokens[this->token] == "OR") {
+        this->token++;
+        Node* right = this->parseAnd();
+        if(left->type != NodeType::OR) {
+            Node* disjunction = this->node(NodeType::OR);
+            disjunction->children.push_back(left);
+            left = disjunction;
+        }
+        left->children.push_back(right);
+    }
+    return left;
+}
+
+/**
+ * Parses a tag, a negated term or a parenthesized expression.
+ *
+ * @throw Exception The expression ends early.
+ */
+BlobQuery::Node* BlobQuery::parseUnary() {
+    if(this->token >= this->tokens.size())
+        throw Exception("Query ends before a tag");
+    const std::string &token = this->tokens[this->token++];
+
+    if(token == "NOT") {
+        Node* operand = this->parseUnary();
+        if(operand->type == NodeType::NOT)
+            return operand->children.front();
+        Node* negation = this->node(NodeType::NOT);
+        negation->children.push_back(operand);
+        return negation;
+    }
+
+    if(token == "(") {
+        Node* group = this->parseOr();
+        if(this->token >= this->tokens.size() || this->tokens[this->token] != ")")
+            throw Exception("Missing ) in query");
+        this->token++;
+        return group;
+    }
+
+    if(token == ")" || token == "AND" || token == "OR")
+        throw Exception("Expected a tag before " + token + " in query");
+
+    // tags are case insensitive, and one which doesn't exist has no blobs
+    std::string name = token;
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    TagRecord* record = this->file->tagTable->get(name);
+    Node* tag = this->node(NodeType::TAG);
+    tag->blobs = record != nullptr ? record->getBlobs() : &this->noBlobs;
+    return tag;
+}
+
+/**
+ * Estimates how many blobs each node can match and orders the children of AND nodes so that the rarest are sought
+ * first, since they rule out the most nonces with each step. Nested nodes of the same kind are flattened, and a NOT
+ * which isn't under an AND is put under one with every blob, since NOT can only rule out blobs.
+ *
+ * @param node The node to plan.
+ * @return The planned node, which may replace the node.
+ */
+BlobQuery::Node* BlobQuery::plan(Node* node) {
+    uint64_t blobCount = this->file->blobTable->size();
+
+    switch(node->type) {
+        case NodeType::ALL:
+            node->estimate = blobCount;
+            return node;
+
+        case NodeType::TAG:
+            node->estimate = node->blobs->size();
+            return node;
+
+        case NodeType::NOT: {
+            Node* conjunction = this->node(NodeType::AND);
+            conjunction->children.push_back(this->node(NodeType::ALL));
+            conjunction->children.push_back(node);
+            return this->plan(conjunction);
+        }
+
+        case NodeType::OR: {
+            std::vector<Node*> children;
+            for(Node* child : node->children) {
+                child = this->plan(child);
+                if(child->type == NodeType::OR)
+                    children.insert(children.end(), child->children.begin(), child->children.end());
+                else if(child->estimate > 0)
+                    children.push_back(child);
+            }
+            node->children.swap(children);
+            for(Node* child : node->children)
+                node->estimate += child->estimate;
+            node->estimate = std::min(node->estimate, blobCount);
+            return node;
+        }
+
+        case NodeType::AND: {
+            std::vector<Node*> children;
+            for(Node* child : node->children) {
+                if(child->type == NodeType::NOT) {
+                    Node* operand = this->plan(child->children.front());
+                    child->children.front() = operand;
+                    child->estimate = blobCount - std::min(operand->estimate, blobCount);
+                    children.push_back(child);
+                    continue;
+                }
+                child = this->plan(child);
+                if(child->type == NodeType::AND)
+                    children.insert(children.end(), child->children.begin(), child->children.end());
+                else
+                    children.push_back(child);
+            }
+
+            // only the nodes which aren't NOTs can produce blobs, every blob is only needed if there are none
+            bool hasPositive = false;
+            for(Node* child : children) {
+                if(child->type != NodeType::NOT && child->type != NodeType::ALL)
+                    hasPositive = true;
+            }
+            if(hasPositive) {
+                children.erase(std::remove_if(children.begin(), children.end(), [](Node* child) {
+                    return child->type == NodeType::ALL;
+                }), children.end());
+            } else if(std::none_of(children.begin(), children.end(), [](Node* child) {
+                return child->type == NodeType::ALL;
+            })) {
+                children.push_back(this->plan(this->node(NodeType::ALL)));
+            }
+
+            // seek the rarest producers first, then the NOTs which rule out the most blobs
+            std::stable_sort(children.begin(), children.end(), [](Node* child1, Node* child2) {
+                bool negated1 = child1->type == NodeType::NOT;
+                bool negated2 = child2->type == NodeType::NOT;
+                if(negated1 != negated2)
+                    return negated2;
+                return child1->estimate < child2->estimate;
+            });
+            node->children.swap(children);
+
+            node->estimate = blobCount;
+            for(Node* child : node->children) {
+                if(child->type != NodeType::NOT)
+                    node->estimate = std::min(node->estimate, child->estimate);
+            }
+            return node;
+        }
+    }
+    return node;
+}
+
+/**
+ * Finds the smallest nonce matched by a node which is at least a target nonce. ALL and NOT nodes match nonces which
+ * aren't blobs too, so the results are checked against the blob table.
+ *
+ * @param node The node.
+ * @param target The smallest nonce to find.
+ * @param value Set to the nonce which was found.
+ * @return Whether a nonce was found.
+ */
+bool BlobQuery::seek(Node* node, uint32_t target, uint32_t &value) {
+
+    // a match found from an earlier target is still the smallest if it's at least this target, as is finding none
+    if(node->cached && node->target <= target && (!node->found || node->result >= target)) {
+        value = node->result;
+        return node->found;
+    }
+
+    bool found = false;
+    uint32_t result = 0;
+    switch(node->type) {
+        case NodeType::ALL:
+            found = target < this->file->blobTableNextNonce;
+            result = target;
+            break;
+
+        case NodeType::TAG:
+            found = node->blobs->next(target, result);
+            break;
+
+        case NodeType::NOT:
+            found = this->skip(node->children.front(), target, result);
+            break;
+
+        case NodeType::OR:
+            for(Node* child : node->children) {
+                uint32_t match;
+                if(this->seek(child, target, match) && (!found || match < result)) {
+                    result = match;
+                    found = true;
+                }
+            }
+            break;
+
+        case NodeType::AND: {
+
+            // leapfrog: each child moves the candidate up to its next match until they all agree on it
+            uint32_t candidate = target;
+            size_t agreed = 0;
+            size_t count = node->children.size();
+            found = count > 0;
+            for(size_t i = 0; found && agreed < count; i = (i + 1) % count) {
+                uint32_t match;
+                if(!this->seek(node->children[i], candidate, match)) {
+                    found = false;
+                } else if(match != candidate) {
+                    candidate = match;
+                    agreed = 1;
+                } else {
+                    agreed++;
+                }
+            }
+            result = candidate;
+            break;
+        }
+    }
+
+    node->cached = true;
+    node->target = target;
+    node->found = found;
+    node->result = result;
+    value = result;
+    return found;
+}
+
+/**
+ * Finds the smallest nonce which is at least a target nonce and isn't matched by a node, which is what a NOT of the
+ * node matches. Runs of matched nonces are jumped over as a whole rather than stepped through.
+ *
+ * @param node The node.
+ * @param target The smallest nonce to find.
+ * @param value Set to the nonce which was found.
+ * @return Whether a nonce was found.
+ */
+bool BlobQuery::skip(Node* node, uint32_t target, uint32_t &value) {
+    switch(node->type) {
+        case NodeType::ALL:
+            value = std::max(target, this->file->blobTableNextNonce);
+            return true;
+
+        case NodeType::TAG:
+            return node->blobs->nextAbsent(target, value);
+
+        case NodeType::NOT:
+            return this->seek(node->children.front(), target, value);
+
+        case NodeType::OR: {
+
+            // every child must miss the candidate, so each one that matches it moves it past the end of its run
+            uint32_t candidate = target;
+            bool moved = true;
+            while(moved) {
+                moved = false;
+                for(Node* child : node->children) {
+                    uint32_t missed;
+                    if(!this->skip(child, candidate, missed))
+                        return false;
+                    if(missed != candidate) {
+                        candidate = missed;
+                        moved = true;
+                    }
+                }
+            }
+            value = candidate;
+            return true;
+        }
+
+        case NodeType::AND: {
+
+            // the first nonce any child misses
+            bool found = false;
+            for(Node* child : node->children) {
+                uint32_t missed;
+                if(this->skip(child, target, missed) && (!found || missed < value)) {
+                    value = missed;
+                    found = true;
+                }
+            }
+            return found;
+        }
+    }
+    return false;
+}
+
+/**
+ * Splits an expression into words and parentheses.
+ *
+ * @param expression The expression.
+ */
+void BlobQuery::tokenize(const std::string &expression) {
+    std::string word;
+    for(char c : expression) {
+        if(std::isspace(static_cast<unsigned char>(c)) || c == '(' || c == ')') {
+            if(!word.empty())
+                this->tokens.push_back(word);
+            word.clear();
+            if(c == '(' || c == ')')
+                this->tokens.emplace_back(1, c);
+            continue;
+        }
+        word += c;
+    }
+    if(!word.empty())
+        this->tokens.push_back(word);
+}
@@ -0,0 +1,180 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+#include <tfc/file.h>
+#include <tfc/reader.h>
+
+using namespace Tfc;
+
+/**
+ * Creates a new reader for a blob. Use File::reader() to open one.
+ *
+ * @param file The file the blob is stored in.
+ * @param record The record of the blob to read.
+ */
+BlobReader::BlobReader(File* file, BlobRecord* record) {
+    this->file = file;
+    this->record = record;
+
+    // find where each run of blocks starts in the blob, so any offset can be found without walking the runs, a chunk
+    // only fills part of its run
+    const Span<Extent>* extents = record->getExtents();
+    const Span<Chunk>* chunks = record->getChunks();
+    uint64_t offset = 0;
+    this->offsets.reserve(extents->size() + 1);
+    for(size_t i = 0; i < extents->size(); i++) {
+        this->offsets.push_back(offset);
+        offset += chunks->empty() ? static_cast<uint64_t>(file->blockSize) * (*extents)[i].length : (*chunks)[i].size;
+    }
+    this->offsets.push_back(offset);
+
+    // find where each frame starts in the stored bytes too
+    if(record->getCodec() != Codec::UNCOMPRESSED) {
+        offset = 0;
+        this->frameOffsets.reserve(record->getFrames()->size());
+        for(uint32_t frame : *record->getFrames()) {
+            this->frameOffsets.push_back(offset);
+            offset += frame;
+        }
+    }
+}
+
+/**
+ * READ operation. Reads bytes from the current position and moves the position past them.
+ *
+ * @param bytes Buffer to read the bytes into.
+ * @param size The maximum number of bytes to read.
+ * @return The number of bytes read. This is less than size only if the end of the blob was reached.
+ */
+uint64_t BlobReader::read(char* bytes, uint64_t size) {
+    uint64_t count = this->pread(this->position, bytes, size);
+    this->position += count;
+    return count;
+}
+
+/**
+ * READ operation. Reads bytes from an offset in the blob. The current position is not changed.
+ *
+ * @param offset The byte offset in the blob to start reading from.
+ * @param bytes Buffer to read the bytes into.
+ * @param size The maximum number of bytes to read.
+ * @return The number of bytes read. This is less than size only if the end of the blob was reached.
+ */
+uint64_t BlobReader::pread(uint64_t offset, char* bytes, uint64_t size) {
+    if(this->file->op != FileMode::READ)
+        throw Exception("File not in READ mode");
+    if(offset >= this->record->getSize())
+        return 0;
+    size = std::min(size, this->record->getSize() - offset);
+
+    // decompress the frames holding the bytes, keeping the last one for the next read
+    if(this->record->getCodec() != Codec::UNCOMPRESSED) {
+        uint64_t frameSize = this->record->getFrameSize();
+        uint64_t count = 0;
+        while(count < size) {
+            auto index = static_cast<uint32_t>((offset + count) / frameSize);
+            if(index != this->frameIndex) {
+                this->frame.resize(frameSize);
+                this->frameIndex = UINT32_MAX;
+                this->file->readFrame(this->record, index, this->frameOffsets[index], this->frame.data());
+                this->frameIndex = index;
+            }
+            uint64_t frameStart = index * frameSize;
+            uint64_t frameEnd = std::min(frameStart + frameSize, this->record->getSize());
+            uint64_t frameCount = std::min(size - count, frameEnd - (offset + count));
+            std::memcpy(bytes + count, this->frame.data() + (offset + count - frameStart), frameCount);
+            count += frameCount;
+        }
+        return count;
+    }
+
+    // find the run of blocks holding the offset
+    auto iter = std::upper_bound(this->offsets.begin(), this->offsets.end(), offset);
+    auto index = static_cast<size_t>(iter - this->offsets.begin()) - 1;
+
+    // read from each run until enough bytes have been read
+    const Span<Extent>* extents = this->record->getExtents();
+    uint64_t count = 0;
+    while(count < size && index < extents->size()) {
+        const Extent &extent = (*extents)[index];
+        uint64_t runOffset = offset + count - this->offsets[index];
+        uint64_t runCount = std::min(size - count, this->offsets[index + 1] - this->offsets[index] - runOffset);
+
+        // read the bytes straight into the caller's buffer
+        this->file->jump(this->file->blockPos(extent.start) + static_cast<std::streamoff>(runOffset));
+        if(!this->file->readBytes(bytes + count, runCount))
+            throw Exception("Failed to read block");
+
+        count += runCount;
+        index++;
+    }
+    if(count < size)
+        throw Exception("Blob " + std::to_string(this->record->getNonce()) + " is missing blocks");
+
+    return count;
+}
+
+/**
+ * READ operation. Returns a pointer to the blob's bytes at an offset without copying them. This only works if the file
+ * is mapped into memory and the blob isn't compressed. The pointer is valid until the file leaves READ mode.
+ *
+ * @param offset The byte offset in the blob.
+ * @param size Set to the number of bytes which can be read from the pointer. This stops at the end of the run of
+ *             blocks holding the offset, so view() should be called again from offset + size for the rest.
+ * @return A pointer to the bytes, or null if the file isn't mapped, the blob is compressed or the offset is past the end
+ *         of the blob.
+ */
+const char* BlobReader::view(uint64_t offset, uint64_t &size) {
+    size = 0;
+    if(this->file->op != FileMode::READ)
+        throw Exception("File not in READ mode");
+    if(this->file->mapping == nullptr || this->record->getCodec() != Codec::UNCOMPRESSED ||
+       offset >= this->record->getSize())
+        return nullptr;
+
+    // find the run of blocks holding the offset
+    auto iter = std::upper_bound(this->offsets.begin(), this->offsets.end(), offset);
+    if(iter == this->offsets.begin())
+        throw Exception("Blob " + std::to_string(this->record->getNonce()) + " is missing blocks");
+    auto index = static_cast<size_t>(iter - this->offsets.begin()) - 1;
+    if(index >= this->record->getExtents()->size())
+        throw Exception("Blob " + std::to_string(this->record->getNonce()) + " is missing blocks");
+    const Extent &extent = (*this->record->getExtents())[index];
+    uint64_t runOffset = offset - this->offsets[index];
+
+    // make sure the run is inside of the mapping
+    auto pos = static_cast<uint64_t>(this->file->blockPos(extent.start)) + runOffset;
+    uint64_t count = std::min(this->record->getSize() - offset,
+                              this->offsets[index + 1] - this->offsets[index] - runOffset);
+    if(pos > this->file->mappingSize || count > this->file->mappingSize - pos)
+        throw Exception("Failed to read block");
+
+    size = count;
+    return this->file->mapping + pos;
+}
+
+/**
+ * Moves the position that the next read() starts from. Seeking past the end of the blob is allowed, but nothing will
+ * be read from there.
+ *
+ * @param offset The byte offset in the blob.
+ */
+void BlobReader::seek(uint64_t offset) {
+    this->position = offset;
+}
@@ -15,11 +15,14 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <tfc/record.h>
 #include <tfc/file.h>
 
 using namespace Tfc;
 
+const uint32_t BlobRecord::MIN_TAG_CAPACITY;
+
 Record::Record(uint32_t nonce) {
     this->nonce = nonce;
 }
@@ -42,24 +45,126 @@ bool Record::desc(Record* record1, Record* record2) {
     return record1->nonce > record2->nonce;
 }
 
-BlobRecord::BlobRecord(uint32_t nonce, const std::string &name, uint64_t hash, std::streampos start, uint64_t size)
-        : Record(nonce)  {
+/**
+ * Creates a blob record. The name isn't copied, so it must outlive the record. The names of the tables' records, and
+ * the runs they refer to, are kept in the file's arena.
+ *
+ * @param nonce The blob's nonce.
+ * @param name The blob's name.
+ * @param nameLength The number of bytes in the name.
+ * @param hashAlgorithm The algorithm the blob's hash was made with.
+ * @param hash The hash of the blob's bytes.
+ * @param size The number of bytes in the blob.
+ */
+BlobRecord::BlobRecord(uint32_t nonce, const char* name, uint32_t nameLength, HashAlgorithm hashAlgorithm,
+                       uint64_t hash, uint64_t size) : Record(nonce)  {
     this->nonce = nonce;
     this->name = name;
+    this->nameLength = nameLength;
+    this->hashAlgorithm = hashAlgorithm;
     this->hash = hash;
-    this->start = start;
     this->size = size;
 }
 
-void BlobRecord::addTag(Tfc::TagRecord* tag) {
-    this->tags.push_back(tag);
+/**
+ * Adds a tag to the blob's tags. The tags are moved to a run twice the size when they outgrow their run.
+ *
+ * @param tag The tag.
+ * @param arena The arena the tags are kept in.
+ */
+void BlobRecord::addTag(Tfc::TagRecord* tag, Arena &arena) {
+    if(this->tags.size() >= this->tagCapacity) {
+        arena.discard(sizeof(TagRecord*) * std::max(static_cast<size_t>(this->tagCapacity), this->tags.size()));
+        this->tagCapacity = std::max(MIN_TAG_CAPACITY, static_cast<uint32_t>(this->tags.size()) * 2);
+        TagRecord** grown = arena.allocateArray<TagRecord*>(this->tagCapacity);
+        std::copy(this->tags.begin(), this->tags.end(), grown);
+        this->tags = Span<TagRecord*>(grown, static_cast<uint32_t>(this->tags.size()));
+    }
+    this->tags.data()[this->tags.size()] = tag;
+    this->tags = Span<TagRecord*>(this->tags.data(), static_cast<uint32_t>(this->tags.size()) + 1);
 }
 
-TagRecord::TagRecord(uint32_t nonce, const std::string &name) : Record(nonce) {
+/**
+ * Copies the runs the blob refers to into an arena, so that the record no longer refers to memory it was built from.
+ *
+ * @param arena The arena.
+ */
+void BlobRecord::copyInto(Arena &arena) {
+    this->extents = Span<Extent>(arena.copy(this->extents.data(), this->extents.size()),
+                                 static_cast<uint32_t>(this->extents.size()));
+    this->chunks = Span<Chunk>(arena.copy(this->chunks.data(), this->chunks.size()),
+                               static_cast<uint32_t>(this->chunks.size()));
+    this->frames = Span<uint32_t>(arena.copy(this->frames.data(), this->frames.size()),
+                                  static_cast<uint32_t>(this->frames.size()));
+    this->tagCapacity = static_cast<uint32_t>(this->tags.size());
+    this->tags = Span<TagRecord*>(arena.copy(this->tags.data(), this->tags.size()), this->tagCapacity);
+}
+
+/**
+ * Returns the number of bytes of the arena taken by the record, its name and the runs it refers to.
+ */
+uint64_t BlobRecord::getArenaSize() {
+    return sizeof(BlobRecord) + this->nameLength + sizeof(Extent) * this->extents.size()
+           + sizeof(Chunk) * this->chunks.size() + sizeof(uint32_t) * this->frames.size()
+           + sizeof(TagRecord*) * std::max(static_cast<size_t>(this->tagCapacity), this->tags.size());
+}
+
+/**
+ * Makes the blob use another blob's stored bytes, along with the chunks and frames they are split into. The runs
+ * describing them are shared rather than copied.
+ *
+ * @param other The record of the blob whose bytes are used.
+ */
+void BlobRecord::copyStorage(BlobRecord* other) {
+    this->extents = other->extents;
+    this->chunks = other->chunks;
+    this->codec = other->codec;
+    this->frameSize = other->frameSize;
+    this->frames = other->frames;
+}
+
+/**
+ * Sets the codec the blob's stored bytes are compressed with. The stored size of each frame is added to getFrames().
+ * A frame whose stored size is the same as its size wasn't compressed, since it didn't get any smaller.
+ *
+ * @param codec The codec.
+ * @param frameSize The number of the blob's bytes in each frame. The last frame may hold fewer.
+ */
+void BlobRecord::setCompression(Codec codec, uint32_t frameSize) {
+    this->codec = codec;
+    this->frameSize = frameSize;
+}
+
+/**
+ * Creates a tag record. The name isn't copied, so it must outlive the record. The record has no set of blobs until it
+ * is added to a tag table.
+ *
+ * @param nonce The tag's nonce.
+ * @param name The tag's name.
+ * @param nameLength The number of bytes in the name.
+ */
+TagRecord::TagRecord(uint32_t nonce, const char* name, uint32_t nameLength) : Record(nonce) {
     this->nonce = nonce;
     this->name = name;
+    this->nameLength = nameLength;
+    this->blobs = nullptr;
 }
 
+/**
+ * Adds a blob to the tag's blobs.
+ *
+ * @param blob The blob.
+ */
 void TagRecord::addBlob(Tfc::BlobRecord *blob) {
-    this->blobs.push_back(blob);
+    this->blobs->add(blob->getNonce());
+}
+
+/**
+ * Removes a blob from the tag's blobs.
+ *
+ * @param blob The blob.
+ * @return Whether the blob had the tag.
+ */
+bool TagRecord::removeBlob(Tfc::BlobRecord *blob) {
+    return this->blobs->remove(blob->getNonce());
 }
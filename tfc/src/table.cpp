@@ -15,47 +15,278 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+#include <cstring>
+#include <tfc/exception.h>
 #include <tfc/table.h>
+#include <xxhash/xxhash.h>
 
 using namespace Tfc;
 
+/**
+ * Adds a new blob to the table. If the blob is chunked, each of its chunks gains a reference.
+ *
+ * @param row A pointer to the row to add.
+ * @throw Exception A blob with the same nonce is already in the table.
+ */
 void BlobTable::add(BlobRecord* row) {
-    this->map.insert({ row->getNonce(), row });
+    uint32_t nonce = row->getNonce();
+    if(nonce < this->rows.size() && this->rows[nonce] != nullptr)
+        throw Exception("Blob " + std::to_string(nonce) + " already exists");
+    if(nonce >= this->rows.size())
+        this->rows.resize(static_cast<size_t>(nonce) + 1, nullptr);
+    else if(this->namesRemoved) // the ordered name index may still hold the nonce of the row which was removed
+        this->sortNames();
+    this->rows[nonce] = row;
+    this->hashIndex.insert(row->getHash(), nonce);
+    this->nameHashIndex.insert(hashName(row->name, row->nameLength), nonce);
+    this->nameIndex.push_back(nonce);
     this->_size++;
+
+    // count the references to the blob's chunks
+    const Span<Chunk>* chunks = row->getChunks();
+    for(size_t i = 0; i < chunks->size(); i++) {
+        const Extent &extent = (*row->getExtents())[i];
+        bool found = false;
+        this->chunkBlockIndex.find(extent.start, [&](uint32_t index) {
+            this->chunks[index].references++;
+            found = true;
+        });
+        if(found)
+            continue;
+
+        // store the chunk in an unused entry if there is one
+        auto index = static_cast<uint32_t>(this->chunks.size());
+        if(this->freeChunks.empty()) {
+            this->chunks.push_back({ (*chunks)[i].hash, (*chunks)[i].size, extent, 1 });
+        } else {
+            index = this->freeChunks.back();
+            this->freeChunks.pop_back();
+            this->chunks[index] = { (*chunks)[i].hash, (*chunks)[i].size, extent, 1 };
+        }
+        this->chunkHashIndex.insert((*chunks)[i].hash, index);
+        this->chunkBlockIndex.insert(extent.start, index);
+    }
 }
 
 BlobRecord* BlobTable::get(uint32_t nonce) {
-    auto row = this->map.find(nonce);
-    if(row == this->map.end())
+    if(nonce >= this->rows.size())
         return nullptr;
-    return row->second;
+    return this->rows[nonce];
 }
 
-void BlobTable::remove(BlobRecord *record) {
-    this->map.erase(record->getNonce());
+/**
+ * Retrieves the blob rows whose content hashes match a hash. Rows with different content can share a hash, so the
+ * content must be compared to find an exact match.
+ *
+ * @param hash The content hash.
+ * @return The matching rows, which may be empty.
+ */
+std::vector<BlobRecord*> BlobTable::getByHash(uint64_t hash) {
+    std::vector<BlobRecord*> rows;
+    this->hashIndex.find(hash, [&](uint32_t nonce) { rows.push_back(this->rows[nonce]); });
+    return rows;
+}
+
+/**
+ * Retrieves the blob rows with a name. Names aren't unique, since files with the same name can be stashed from
+ * different places.
+ *
+ * @param name The name.
+ * @return The matching rows in ascending order of nonce, which may be empty.
+ */
+std::vector<BlobRecord*> BlobTable::getByName(const std::string &name) {
+    std::vector<BlobRecord*> rows;
+    this->nameHashIndex.find(hashName(name.data(), name.size()), [&](uint32_t nonce) {
+        if(compareName(this->rows[nonce], name.data(), name.size()) == 0)
+            rows.push_back(this->rows[nonce]);
+    });
+    std::sort(rows.begin(), rows.end(), Record::asc);
+    return rows;
+}
+
+/**
+ * Retrieves the blob rows whose names start with a prefix.
+ *
+ * @param prefix The prefix.
+ * @return The matching rows in order of name, then of nonce, which may be empty.
+ */
+std::vector<BlobRecord*> BlobTable::getByNamePrefix(const std::string &prefix) {
+    this->sortNames();
+    auto first = std::lower_bound(this->nameIndex.begin(), this->nameIndex.end(), prefix,
+                                  [this](uint32_t nonce, const std::string &prefix) {
+                                      return compareName(this->rows[nonce], prefix.data(), prefix.size()) < 0;
+                                  });
+    std::vector<BlobRecord*> rows;
+    for(auto iter = first; iter != this->nameIndex.end(); iter++) {
+        BlobRecord* row = this->rows[*iter];
+        if(row->nameLength < prefix.size() || std::memcmp(row->name, prefix.data(), prefix.size()) != 0)
+            break;
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+/**
+ * Retrieves the stored chunks whose hashes match a hash. Chunks with different content can share a hash, so the
+ * content must be compared to find an exact match.
+ *
+ * @param hash The chunk hash.
+ * @return The matching chunks, which may be empty.
+ */
+std::vector<ChunkEntry> BlobTable::getChunksByHash(uint64_t hash) {
+    std::vector<ChunkEntry> chunks;
+    this->chunkHashIndex.find(hash, [&](uint32_t index) { chunks.push_back(this->chunks[index]); });
+    return chunks;
+}
+
+/**
+ * Removes a blob from the table. If the blob is chunked, each of its chunks loses a reference. The blob's nonce is
+ * left in the ordered name index until the index is next sorted.
+ *
+ * @param record The record to be removed.
+ * @return The runs of blocks holding chunks which no blob refers to anymore.
+ */
+std::vector<Extent> BlobTable::remove(BlobRecord *record) {
+    this->rows[record->getNonce()] = nullptr;
+    this->hashIndex.remove(record->getHash(), record->getNonce());
+    this->nameHashIndex.remove(hashName(record->name, record->nameLength), record->getNonce());
+    this->namesRemoved = true;
     this->_size--;
+
+    // drop the chunks which were only referred to by this blob
+    std::vector<Extent> unused;
+    if(record->getChunks()->empty())
+        return unused;
+    for(const Extent &extent : *record->getExtents()) {
+        uint32_t index = UINT32_MAX;
+        this->chunkBlockIndex.find(extent.start, [&](uint32_t found) { index = found; });
+        if(index == UINT32_MAX || --this->chunks[index].references > 0)
+            continue;
+        ChunkEntry &entry = this->chunks[index];
+        this->chunkHashIndex.remove(entry.hash, index);
+        this->chunkBlockIndex.remove(extent.start, index);
+        this->freeChunks.push_back(index);
+        unused.push_back(entry.extent);
+    }
+    return unused;
+}
+
+/**
+ * Makes room for a number of rows, so that loading them doesn't grow the indexes one step at a time.
+ *
+ * @param count The number of rows.
+ */
+void BlobTable::reserve(uint32_t count) {
+    this->rows.reserve(count);
+    this->hashIndex.reserve(count);
+    this->nameHashIndex.reserve(count);
+    this->nameIndex.reserve(count);
 }
 
 uint32_t BlobTable::size() {
     return this->_size;
 }
 
-std::map<uint32_t, BlobRecord *>::iterator BlobTable::begin() {
-    return this->map.begin();
+RowIterator<BlobRecord> BlobTable::begin() {
+    return RowIterator<BlobRecord>(&this->rows, 0);
+}
+
+RowIterator<BlobRecord> BlobTable::end() {
+    return RowIterator<BlobRecord>(&this->rows, this->rows.size());
+}
+
+/**
+ * Finds the first blob row whose nonce is at least a given nonce.
+ *
+ * @param nonce The smallest nonce to find.
+ * @return An iterator to the row, or end() if there is none.
+ */
+RowIterator<BlobRecord> BlobTable::lowerBound(uint32_t nonce) {
+    return RowIterator<BlobRecord>(&this->rows, std::min(static_cast<size_t>(nonce), this->rows.size()));
+}
+
+/**
+ * Compares a row's name with a name, byte by byte.
+ *
+ * @param row The row.
+ * @param name The name.
+ * @param length The number of bytes in the name.
+ * @return Less than zero if the row's name comes first, zero if they are the same, otherwise more than zero.
+ */
+int BlobTable::compareName(const BlobRecord* row, const char* name, size_t length) {
+    int order = std::memcmp(row->name, name, std::min(static_cast<size_t>(row->nameLength), length));
+    if(order != 0)
+        return order;
+    return row->nameLength < length ? -1 : (row->nameLength > length ? 1 : 0);
+}
+
+/**
+ * Hashes a name for the name hash index.
+ *
+ * @param name The name.
+ * @param length The number of bytes in the name.
+ */
+uint64_t BlobTable::hashName(const char* name, size_t length) {
+    return XXH3_64bits(name, length);
 }
 
-std::map<uint32_t, BlobRecord *>::iterator BlobTable::end() {
-    return this->map.end();
+/**
+ * Brings the name index up to date. The nonces of removed rows are dropped, and the nonces added since the index was
+ * last sorted are sorted and merged into the rest, so a lookup after a few additions doesn't sort every name again.
+ */
+void BlobTable::sortNames() {
+    if(this->namesRemoved) {
+        size_t kept = 0;
+        size_t keptSorted = 0;
+        for(size_t i = 0; i < this->nameIndex.size(); i++) {
+            if(this->rows[this->nameIndex[i]] == nullptr)
+                continue;
+            if(i < this->sortedNames)
+                keptSorted++;
+            this->nameIndex[kept++] = this->nameIndex[i];
+        }
+        this->nameIndex.resize(kept);
+        this->sortedNames = keptSorted;
+        this->namesRemoved = false;
+    }
+    if(this->sortedNames == this->nameIndex.size())
+        return;
+
+    auto before = [this](uint32_t nonce1, uint32_t nonce2) {
+        const BlobRecord* row = this->rows[nonce2];
+        int order = compareName(this->rows[nonce1], row->name, row->nameLength);
+        return order < 0 || (order == 0 && nonce1 < nonce2);
+    };
+    auto middle = this->nameIndex.begin() + static_cast<std::ptrdiff_t>(this->sortedNames);
+    std::sort(middle, this->nameIndex.end(), before);
+    std::inplace_merge(this->nameIndex.begin(), middle, this->nameIndex.end(), before);
+    this->sortedNames = this->nameIndex.size();
 }
 
 /**
- * Adds a new tag to the table.
+ * Adds a new tag to the table, with an empty set of blobs.
  *
  * @param row A pointer to the row to add.
+ * @throw Exception A tag with the same nonce or name is already in the table.
  */
 void TagTable::add(TagRecord* row) {
-    this->nonceMap.insert({ row->getNonce(), row });
-    this->nameMap.insert({ row->getName(), row });
+    uint32_t nonce = row->getNonce();
+    if(nonce < this->rows.size() && this->rows[nonce] != nullptr)
+        throw Exception("Tag " + std::to_string(nonce) + " already exists");
+    if(this->trie.find(row->getName()) != nullptr)
+        throw Exception("Tag " + row->getName() + " already exists");
+    if(nonce >= this->rows.size())
+        this->rows.resize(static_cast<size_t>(nonce) + 1, nullptr);
+    this->rows[nonce] = row;
+    if(this->freePostings.empty()) {
+        this->postings.emplace_back();
+        row->blobs = &this->postings.back();
+    } else {
+        row->blobs = this->freePostings.back();
+        this->freePostings.pop_back();
+    }
+    this->trie.add(row);
     this->_size++;
 }
 
@@ -66,23 +297,19 @@ void TagTable::add(TagRecord* row) {
  * @return The tag's row if it exists, otherwise nullptr.
  */
 TagRecord* TagTable::get(uint32_t nonce) {
-    auto row = this->nonceMap.find(nonce);
-    if(row == this->nonceMap.end())
+    if(nonce >= this->rows.size())
         return nullptr;
-    return row->second;
+    return this->rows[nonce];
 }
 
 /**
  * Retrieves a tag row given a unique name.
  *
- * @param nonce A unique name for the tag.
+ * @param name A unique name for the tag.
  * @return The tag's row if it exists, otherwise nullptr.
  */
-TagRecord* TagTable::get(std::string name) {
-    auto row = this->nameMap.find(name);
-    if(row == this->nameMap.end())
-        return nullptr;
-    return row->second;
+TagRecord* TagTable::get(const std::string &name) {
+    return this->trie.find(name);
 }
 
 /**
@@ -91,8 +318,10 @@ TagRecord* TagTable::get(std::string name) {
  * @param record The record to be removed.
  */
 void TagTable::remove(TagRecord *record) {
-    this->nameMap.erase(record->name);
-    this->nonceMap.erase(record->getNonce());
+    this->rows[record->getNonce()] = nullptr;
+    *record->blobs = Bitmap();
+    this->freePostings.push_back(record->blobs);
+    this->trie.remove(record);
     this->_size--;
 };
 
@@ -103,10 +332,10 @@ uint32_t TagTable::size() {
     return this->_size;
 }
 
-std::map<std::string, TagRecord*>::iterator TagTable::begin() {
-    return this->nameMap.begin();
+RowIterator<TagRecord> TagTable::begin() {
+    return RowIterator<TagRecord>(&this->rows, 0);
 }
 
-std::map<std::string, TagRecord*>::iterator TagTable::end() {
-    return this->nameMap.end();
+RowIterator<TagRecord> TagTable::end() {
+    return RowIterator<TagRecord>(&this->rows, this->rows.size());
 }
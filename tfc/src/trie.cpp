@@ -0,0 +1,282 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <tfc/record.h>
+#include <tfc/trie.h>
+
+using namespace Tfc;
+
+const uint32_t TagTrie::NO_NODE;
+
+/**
+ * Creates an empty trie.
+ */
+TagTrie::TagTrie() {
+    this->nodes.emplace_back();
+}
+
+/**
+ * Adds a tag to the trie under its name.
+ *
+ * @param record The tag.
+ */
+void TagTrie::add(TagRecord* record) {
+    uint32_t node = 0;
+    for(unsigned char c : record->getName()) {
+        uint32_t next = this->child(node, c);
+        if(next == NO_NODE) {
+            if(this->freeNodes.empty()) {
+                next = static_cast<uint32_t>(this->nodes.size());
+                this->nodes.emplace_back();
+            } else {
+                next = this->freeNodes.back();
+                this->freeNodes.pop_back();
+            }
+
+            // keep the children sorted by unsigned character, so the names are walked in the order they compare in
+            std::vector<std::pair<unsigned char, uint32_t>> &children = this->nodes[node].children;
+            children.insert(std::upper_bound(children.begin(), children.end(), std::make_pair(c, next),
+                                             [](const std::pair<unsigned char, uint32_t> &a,
+                                                const std::pair<unsigned char, uint32_t> &b) {
+                                                 return a.first < b.first;
+                                             }), std::make_pair(c, next));
+        }
+        node = next;
+    }
+    this->nodes[node].record = record;
+}
+
+/**
+ * Finds the tag with a name.
+ *
+ * @param name The name.
+ * @return The tag, or nullptr if there is none.
+ */
+TagRecord* TagTrie::find(const std::string &name) const {
+    uint32_t node = 0;
+    for(size_t i = 0; i < name.size() && node != NO_NODE; i++)
+        node = this->child(node, static_cast<unsigned char>(name[i]));
+    return node != NO_NODE ? this->nodes[node].record : nullptr;
+}
+
+/**
+ * Finds the tags whose names match a pattern, in which * matches any run of characters and ? matches any one
+ * character. Each node is visited at most once for each position in the pattern, however many stars it has.
+ *
+ * @param pattern The pattern.
+ * @return The matching tags, in order of name.
+ */
+std::vector<TagRecord*> TagTrie::match(const std::string &pattern) const {
+
+    // a pattern whose only wildcard is a star at the end is a prefix, whose tags are already in order
+    size_t wildcard = pattern.find_first_of("*?");
+    if(wildcard != std::string::npos && wildcard + 1 == pattern.size() && pattern[wildcard] == '*')
+        return this->prefixed(pattern.substr(0, wildcard));
+
+    std::vector<TagRecord*> records;
+    std::unordered_set<uint64_t> visited;
+    this->matchFrom(0, pattern, 0, visited, records);
+    std::sort(records.begin(), records.end(), [](TagRecord* tag1, TagRecord* tag2) {
+        return tag1->getName() < tag2->getName();
+    });
+    return records;
+}
+
+/**
+ * Finds the tags whose names start with a prefix.
+ *
+ * @param prefix The prefix.
+ * @return The matching tags, in order of name.
+ */
+std::vector<TagRecord*> TagTrie::prefixed(const std::string &prefix) const {
+    std::vector<TagRecord*> records;
+    uint32_t node = 0;
+    for(size_t i = 0; i < prefix.size() && node != NO_NODE; i++)
+        node = this->child(node, static_cast<unsigned char>(prefix[i]));
+    if(node != NO_NODE)
+        this->collect(node, records);
+    return records;
+}
+
+/**
+ * Removes a tag from the trie. The nodes of its name which no longer lead to any tag are pruned and kept for reuse.
+ *
+ * @param record The tag.
+ */
+void TagTrie::remove(TagRecord* record) {
+    const std::string &name = record->getName();
+    std::vector<uint32_t> path(1, 0);
+    for(unsigned char c : name) {
+        uint32_t next = this->child(path.back(), c);
+        if(next == NO_NODE)
+            return;
+        path.push_back(next);
+    }
+    if(this->nodes[path.back()].record != record)
+        return;
+    this->nodes[path.back()].record = nullptr;
+
+    // prune from the end of the name back up, until a node still holds a tag or leads to another one
+    for(size_t i = path.size() - 1; i > 0; i--) {
+        Node &node = this->nodes[path[i]];
+        if(node.record != nullptr || !node.children.empty())
+            break;
+        this->freeNodes.push_back(path[i]);
+
+        std::vector<std::pair<unsigned char, uint32_t>> &children = this->nodes[path[i - 1]].children;
+        children.erase(std::find_if(children.begin(), children.end(),
+                                    [&](const std::pair<unsigned char, uint32_t> &child) {
+                                        return child.second == path[i];
+                                    }));
+    }
+}
+
+/**
+ * Finds the tags whose names are within an edit distance of a name, counting each inserted, deleted or replaced
+ * character as one edit. A row of the edit distance table is computed for each node walked, and a branch is left as
+ * soon as every entry of its row is over the distance.
+ *
+ * @param name The name.
+ * @param maxDistance The most edits a matching name can be from the name.
+ * @return The matching tags, the closest first, then in order of name.
+ */
+std::vector<TagRecord*> TagTrie::similar(const std::string &name, uint32_t maxDistance) const {
+
+    // the root's row is the distance of each prefix of the name from the empty string
+    std::vector<uint32_t> row(name.size() + 1);
+    for(size_t i = 0; i < row.size(); i++)
+        row[i] = static_cast<uint32_t>(i);
+
+    std::vector<std::pair<uint32_t, TagRecord*>> matches;
+    if(this->nodes[0].record != nullptr && row.back() <= maxDistance)
+        matches.emplace_back(row.back(), this->nodes[0].record);
+    this->similarFrom(0, name, row, maxDistance, matches);
+
+    std::stable_sort(matches.begin(), matches.end(), [](const std::pair<uint32_t, TagRecord*> &match1,
+                                                        const std::pair<uint32_t, TagRecord*> &match2) {
+        return match1.first < match2.first;
+    });
+    std::vector<TagRecord*> records;
+    records.reserve(matches.size());
+    for(auto &match : matches)
+        records.push_back(match.second);
+    return records;
+}
+
+/**
+ * Finds the child of a node reached by a character.
+ *
+ * @param node The index of the node.
+ * @param c The character.
+ * @return The index of the child, or NO_NODE if there is none.
+ */
+uint32_t TagTrie::child(uint32_t node, unsigned char c) const {
+    const std::vector<std::pair<unsigned char, uint32_t>> &children = this->nodes[node].children;
+    auto iter = std::lower_bound(children.begin(), children.end(), c,
+                                 [](const std::pair<unsigned char, uint32_t> &child, unsigned char c) {
+                                     return child.first < c;
+                                 });
+    if(iter == children.end() || iter->first != c)
+        return NO_NODE;
+    return iter->second;
+}
+
+/**
+ * Adds the tags at and below a node in order of name.
+ *
+ * @param node The index of the node.
+ * @param records The tags found so far.
+ */
+void TagTrie::collect(uint32_t node, std::vector<TagRecord*> &records) const {
+    if(this->nodes[node].record != nullptr)
+        records.push_back(this->nodes[node].record);
+    for(auto &child : this->nodes[node].children)
+        this->collect(child.second, records);
+}
+
+/**
+ * Adds the tags below a node whose names match the rest of a pattern.
+ *
+ * @param node The index of the node.
+ * @param pattern The pattern.
+ * @param index The position in the pattern which the node's characters have matched up to.
+ * @param visited The node and pattern positions which have been walked.
+ * @param records The tags found so far.
+ */
+void TagTrie::matchFrom(uint32_t node, const std::string &pattern, size_t index,
+                        std::unordered_set<uint64_t> &visited, std::vector<TagRecord*> &records) const {
+    if(!visited.insert(static_cast<uint64_t>(node) * (pattern.size() + 1) + index).second)
+        return;
+
+    if(index == pattern.size()) {
+        if(this->nodes[node].record != nullptr)
+            records.push_back(this->nodes[node].record);
+        return;
+    }
+
+    switch(pattern[index]) {
+        case '*':
+            // the star matches nothing more, or one more character
+            this->matchFrom(node, pattern, index + 1, visited, records);
+            for(auto &child : this->nodes[node].children)
+                this->matchFrom(child.second, pattern, index, visited, records);
+            break;
+
+        case '?':
+            for(auto &child : this->nodes[node].children)
+                this->matchFrom(child.second, pattern, index + 1, visited, records);
+            break;
+
+        default: {
+            uint32_t next = this->child(node, static_cast<unsigned char>(pattern[index]));
+            if(next != NO_NODE)
+                this->matchFrom(next, pattern, index + 1, visited, records);
+        }
+    }
+}
+
+/**
+ * Adds the tags below a node whose names are within an edit distance of a name.
+ *
+ * @param node The index of the node.
+ * @param name The name.
+ * @param row The edit distance of each prefix of the name from the node's characters.
+ * @param maxDistance The most edits a matching name can be from the name.
+ * @param records The tags found so far and their distances.
+ */
+void TagTrie::similarFrom(uint32_t node, const std::string &name, const std::vector<uint32_t> &row,
+                          uint32_t maxDistance, std::vector<std::pair<uint32_t, TagRecord*>> &records) const {
+    std::vector<uint32_t> next(row.size());
+    for(auto &child : this->nodes[node].children) {
+
+        // extend the table by the child's character
+        next[0] = row[0] + 1;
+        uint32_t smallest = next[0];
+        for(size_t i = 1; i < row.size(); i++) {
+            uint32_t replace = row[i - 1] + (static_cast<unsigned char>(name[i - 1]) == child.first ? 0 : 1);
+            next[i] = std::min(std::min(next[i - 1] + 1, row[i] + 1), replace);
+            smallest = std::min(smallest, next[i]);
+        }
+
+        const Node &childNode = this->nodes[child.second];
+        if(childNode.record != nullptr && next.back() <= maxDistance)
+            records.emplace_back(next.back(), childNode.record);
+        if(smallest <= maxDistance)
+            this->similarFrom(child.second, name, next, maxDistance, records);
+    }
+}
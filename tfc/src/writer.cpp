@@ -0,0 +1,370 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+#include <xxhash/xxhash.h>
+#include <zstd/zstd.h>
+#include <tfc/chunker.h>
+#include <tfc/file.h>
+#include <tfc/writer.h>
+
+using namespace Tfc;
+
+/**
+ * Creates a new writer for a blob. Use File::writer() to open one.
+ *
+ * @param file The file the blob will be written to.
+ * @param name The display name of the blob.
+ */
+BlobWriter::BlobWriter(File* file, const std::string &name) {
+    this->file = file;
+    this->name = name;
+    this->deduplicate = file->deduplication;
+    this->chunked = file->chunking;
+    this->compressed = file->compression && !this->chunked;
+    this->buffer.reserve(this->chunked ? Chunker::MAX_CHUNK_SIZE : file->blockSize);
+    if(this->compressed)
+        this->frame.reserve(file->COMPRESSION_FRAME_SIZE);
+
+    // create hash state for storing progress
+    this->hashState = XXH3_createState();
+    if(this->hashState == nullptr) // error occurred
+        throw Exception("Failed to allocate hash state");
+
+    // set the seed for this hash, we'll just use the file's magic number as the seed
+    if(XXH3_64bits_reset_withSeed(this->hashState, file->MAGIC_NUMBER) == XXH_ERROR) {
+        XXH3_freeState(this->hashState);
+        throw Exception("Failed to seed the hash state");
+    }
+}
+
+/**
+ * Destroys the writer. If the blob was not committed, it is aborted.
+ */
+BlobWriter::~BlobWriter() {
+    if(!this->done) {
+        try {
+            this->abort();
+        } catch(Exception &ex) {
+            // the blocks are still marked as free in memory, there's nothing else to do
+        }
+    }
+    XXH3_freeState(this->hashState);
+}
+
+/**
+ * EDIT operation. Discards the blob. The blocks it was written to are returned to the free block index, apart from
+ * those of chunks which were already stored.
+ */
+void BlobWriter::abort() {
+    this->check();
+    this->done = true;
+
+    // free the blocks that were written to
+    for(const Extent &extent : this->chunked ? this->stored : this->extents)
+        this->file->allocator->free(extent.start, extent.length);
+    this->extents.clear();
+    this->chunks.clear();
+    this->stored.clear();
+}
+
+/**
+ * EDIT operation. Appends bytes to the blob. Whole blocks are written to the file immediately; any bytes left over are
+ * held until more bytes are appended or the blob is committed. If the blob is chunked, bytes are held until a whole
+ * chunk can be cut from them instead, and if it is compressed, until they fill a whole frame.
+ *
+ * @param bytes Pointer to the bytes to append.
+ * @param size The number of bytes to append.
+ */
+void BlobWriter::append(const char* bytes, uint64_t size) {
+    this->check();
+    if(size == 0)
+        return;
+
+    // add the bytes to the hash, straight from the caller's buffer
+    if(XXH3_64bits_update(this->hashState, bytes, size) == XXH_ERROR)
+        throw Exception("Failed to update hash state with block");
+    this->size += size;
+
+    // cut the held bytes into chunks once there are enough of them to be sure where each chunk ends
+    if(this->chunked) {
+        this->buffer.insert(this->buffer.end(), bytes, bytes + size);
+        uint64_t offset = 0;
+        uint64_t count;
+        while((count = Chunker::cut(this->buffer.data() + offset, this->buffer.size() - offset, false)) > 0) {
+            this->writeChunk(this->buffer.data() + offset, static_cast<uint32_t>(count));
+            offset += count;
+        }
+        this->buffer.erase(this->buffer.begin(), this->buffer.begin() + static_cast<std::ptrdiff_t>(offset));
+        return;
+    }
+
+    // compress each frame once it's full
+    uint32_t frameSize = this->file->COMPRESSION_FRAME_SIZE;
+    while(this->compressed && size > 0) {
+        uint64_t count = std::min(size, static_cast<uint64_t>(frameSize - this->frame.size()));
+        this->frame.insert(this->frame.end(), bytes, bytes + count);
+        bytes += count;
+        size -= count;
+        if(this->frame.size() == frameSize) {
+            this->writeFrame(this->frame.data(), frameSize);
+            this->frame.clear();
+        }
+    }
+    this->writeBytes(bytes, size);
+}
+
+/**
+ * Writes bytes to the blob's blocks. Whole blocks are written to the file immediately; any bytes left over are held
+ * until more bytes are written or the blob is committed.
+ *
+ * @param bytes Pointer to the bytes to write.
+ * @param size The number of bytes to write.
+ */
+void BlobWriter::writeBytes(const char* bytes, uint64_t size) {
+    if(size == 0)
+        return;
+    uint32_t blockSize = this->file->blockSize;
+
+    // fill up the partial block left over from the last append
+    if(!this->buffer.empty()) {
+        uint64_t count = std::min(size, static_cast<uint64_t>(blockSize - this->buffer.size()));
+        this->buffer.insert(this->buffer.end(), bytes, bytes + count);
+        bytes += count;
+        size -= count;
+
+        // write the block once it's full
+        if(this->buffer.size() == blockSize) {
+            this->writeBlocks(this->buffer.data(), 1);
+            this->buffer.clear();
+        }
+    }
+
+    // write whole blocks straight from the caller's bytes
+    uint64_t wholeBlocks = size / blockSize;
+    while(wholeBlocks > 0) {
+        auto count = static_cast<uint32_t>(std::min(wholeBlocks, static_cast<uint64_t>(UINT32_MAX)));
+        this->writeBlocks(bytes, count);
+        bytes += static_cast<uint64_t>(blockSize) * count;
+        size -= static_cast<uint64_t>(blockSize) * count;
+        wholeBlocks -= count;
+    }
+
+    // hold on to the rest
+    this->buffer.insert(this->buffer.end(), bytes, bytes + size);
+}
+
+/**
+ * EDIT operation. Writes out any held bytes and adds the blob to the container. If deduplication is on and an
+ * identical blob is already stored, the blob shares its blocks instead, and the blocks that were written are freed.
+ *
+ * @return The container index that was assigned to the blob.
+ */
+uint32_t BlobWriter::commit() {
+    this->check();
+
+    // write the last chunks
+    if(this->chunked) {
+        uint64_t offset = 0;
+        while(offset < this->buffer.size()) {
+            uint64_t count = Chunker::cut(this->buffer.data() + offset, this->buffer.size() - offset, true);
+            this->writeChunk(this->buffer.data() + offset, static_cast<uint32_t>(count));
+            offset += count;
+        }
+        this->buffer.clear();
+    }
+
+    // compress the last frame
+    if(this->compressed && !this->frame.empty()) {
+        this->writeFrame(this->frame.data(), static_cast<uint32_t>(this->frame.size()));
+        this->frame.clear();
+    }
+
+    // write the last partial block, padded with zeroes
+    if(!this->buffer.empty()) {
+        this->buffer.resize(this->file->blockSize, 0x0);
+        this->writeBlocks(this->buffer.data(), 1);
+        this->buffer.clear();
+    }
+
+    // describe how the blob's bytes were stored, the runs are copied into the file's arena when the record is added
+    BlobRecord pending(0, this->name.data(), static_cast<uint32_t>(this->name.size()), HashAlgorithm::XXHASH3_64,
+                       XXH3_64bits_digest(this->hashState), this->size);
+    *pending.getExtents() = Span<Extent>(this->extents);
+    *pending.getChunks() = Span<Chunk>(this->chunks);
+    if(this->compressed && !this->frames.empty()) {
+        pending.setCompression(Codec::ZSTD, this->file->COMPRESSION_FRAME_SIZE);
+        *pending.getFrames() = Span<uint32_t>(this->frames);
+    }
+
+    // share the blocks of an identical blob
+    if(this->deduplicate) {
+        BlobRecord* original = this->file->findDuplicate(pending.getHash(), this->size, nullptr, &pending);
+        if(original != nullptr) {
+            for(const Extent &extent : this->chunked ? this->stored : this->extents)
+                this->file->allocator->free(extent.start, extent.length);
+            pending.copyStorage(original);
+        }
+    }
+
+    // create new record in blob table
+    this->done = true;
+    return this->file->addRecord(&pending);
+}
+
+/**
+ * Checks that the blob can still be written to.
+ *
+ * @throw Exception The blob was already committed or aborted, or the file is not in EDIT mode.
+ */
+void BlobWriter::check() {
+    if(this->done)
+        throw Exception("Blob has already been committed or aborted");
+    if(this->file->op != FileMode::EDIT)
+        throw Exception("File not in EDIT mode");
+}
+
+/**
+ * Whether a run of blocks holds the same bytes as a new chunk.
+ *
+ * @param extent The run of blocks holding a stored chunk of the same size.
+ * @param bytes Pointer to the new chunk's bytes.
+ * @param size The size of the chunk in bytes.
+ */
+bool BlobWriter::isStored(const Extent &extent, const char* bytes, uint32_t size) {
+    this->scratch.resize(size);
+    Extent run = extent;
+    this->file->readExtents(Span<Extent>(&run, 1), Span<Chunk>(), 0, this->scratch.data(), size);
+    return std::memcmp(this->scratch.data(), bytes, size) == 0;
+}
+
+/**
+ * Writes whole blocks to the file. The blocks are written straight after the last block if it is followed by free
+ * blocks, so that the blob is stored in as few runs as possible.
+ *
+ * @param bytes Pointer to the bytes to write.
+ * @param count The number of whole blocks to write.
+ */
+void BlobWriter::writeBlocks(const char* bytes, uint32_t count) {
+    BlockAllocator* allocator = this->file->allocator;
+    uint32_t blockSize = this->file->blockSize;
+    while(count > 0) {
+
+        // continue the last run if we can, otherwise start a new one
+        Extent run = { 0, 0 };
+        if(!this->extents.empty()) {
+            Extent &last = this->extents.back();
+            run = { last.start + last.length, allocator->extend(last, count) };
+            last.length += run.length;
+        }
+        if(run.length == 0) {
+            run = allocator->allocate(count);
+            this->extents.push_back(run);
+        }
+
+        // write the run in one go
+        this->file->jump(this->file->blockPos(run.start));
+        this->file->stream.write(bytes, static_cast<std::streamsize>(blockSize) * run.length);
+        if(this->file->stream.fail())
+            throw Exception("Failed to write blob data");
+
+        bytes += static_cast<uint64_t>(blockSize) * run.length;
+        count -= run.length;
+    }
+}
+
+/**
+ * Adds a chunk to the blob. If an identical chunk is already stored, by this blob or any other, the blob refers to its
+ * blocks. Otherwise, the chunk is written to a new run of blocks, padded with zeroes.
+ *
+ * @param bytes Pointer to the chunk's bytes.
+ * @param size The size of the chunk in bytes.
+ */
+void BlobWriter::writeChunk(const char* bytes, uint32_t size) {
+    uint64_t hash = XXH3_64bits_withSeed(bytes, size, this->file->MAGIC_NUMBER);
+
+    // look for an identical chunk stored for this blob, then for any other
+    Extent extent = { 0, 0 };
+    auto range = this->storedChunks.equal_range(hash);
+    for(auto iter = range.first; extent.length == 0 && iter != range.second; iter++) {
+        if(this->chunks[iter->second].size == size && this->isStored(this->extents[iter->second], bytes, size))
+            extent = this->extents[iter->second];
+    }
+    if(extent.length == 0) {
+        for(const ChunkEntry &entry : this->file->blobTable->getChunksByHash(hash)) {
+            if(entry.size == size && this->isStored(entry.extent, bytes, size)) {
+                extent = entry.extent;
+                break;
+            }
+        }
+    }
+
+    // store the chunk if it's new
+    if(extent.length == 0) {
+        extent = this->file->allocator->allocateRun(this->file->blocksFor(size));
+        this->file->jump(this->file->blockPos(extent.start));
+        this->file->stream.write(bytes, size);
+        std::vector<char> padding(static_cast<uint64_t>(this->file->blockSize) * extent.length - size, 0x0);
+        this->file->stream.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+        if(this->file->stream.fail())
+            throw Exception("Failed to write blob data");
+        this->stored.push_back(extent);
+        this->storedChunks.insert({ hash, this->chunks.size() });
+    }
+
+    this->extents.push_back(extent);
+    this->chunks.push_back({ size, hash });
+}
+
+/**
+ * Compresses a frame and writes it to the blob's blocks. A frame which doesn't get any smaller is written as is. If
+ * the first frame doesn't shrink by enough, compressing the blob isn't worth it, and the whole blob is written as is.
+ *
+ * @param bytes Pointer to the frame's bytes.
+ * @param size The size of the frame in bytes.
+ */
+void BlobWriter::writeFrame(const char* bytes, uint32_t size) {
+    File* file = this->file;
+    if(file->compressor == nullptr) {
+        file->compressor = ZSTD_createCCtx();
+        if(file->compressor == nullptr)
+            throw Exception("Failed to allocate compression context");
+    }
+
+    // compress into the scratch buffer
+    this->scratch.resize(ZSTD_compressBound(size));
+    size_t count = ZSTD_compressCCtx(file->compressor, this->scratch.data(), this->scratch.size(), bytes, size,
+                                     file->COMPRESSION_LEVEL);
+    if(ZSTD_isError(count))
+        throw Exception("Failed to compress blob data");
+
+    // give up on compressing the blob if it doesn't compress well
+    if(this->frames.empty() && count > size - size / file->MIN_COMPRESSION_SAVING) {
+        this->compressed = false;
+        this->writeBytes(bytes, size);
+        return;
+    }
+
+    if(count >= size) {
+        this->writeBytes(bytes, size);
+        this->frames.push_back(size);
+    } else {
+        this->writeBytes(this->scratch.data(), count);
+        this->frames.push_back(static_cast<uint32_t>(count));
+    }
+}
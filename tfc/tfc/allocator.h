@@ -0,0 +1,59 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TFC_ALLOCATOR_H
+#define TFC_ALLOCATOR_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <tfc/record.h>
+
+namespace Tfc {
+
+    class BlockAllocator {
+
+    public:
+        explicit BlockAllocator(uint32_t blockCount);
+
+        Extent   allocate(uint32_t count);
+        Extent   allocateRun(uint32_t count);
+        uint32_t extend(const Extent &extent, uint32_t count);
+        void     free(uint32_t block, uint32_t count = 1);
+        void     grow(uint32_t blockCount);
+        void     use(uint32_t block, uint32_t count = 1);
+
+        // accessors
+        uint32_t getBlockCount() { return this->blockCount; }
+        uint32_t getFreeCount() { return this->freeCount; }
+        const std::map<uint32_t, uint32_t>* getExtents() { return &this->extents; }
+
+    private:
+        uint32_t blockCount;                  // number of blocks in the block list
+        uint32_t freeCount = 0;               // number of free blocks in the block list
+        std::map<uint32_t, uint32_t> extents; // free extents, start block -> length
+        std::set<std::pair<uint32_t, uint32_t>> sizes; // free extents ordered by size, (length, start block)
+
+        void     add(uint32_t block, uint32_t count);
+        void     growBy(uint32_t count);
+        std::map<uint32_t, uint32_t>::iterator remove(std::map<uint32_t, uint32_t>::iterator extent);
+
+    };
+
+}
+
+#endif //TFC_ALLOCATOR_H
@@ -0,0 +1,108 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TFC_ARENA_H
+#define TFC_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Tfc {
+
+    // a monotonic allocator which hands out memory from large blocks and frees all of it at once. Objects can't be
+    // freed one at a time, they live until the arena is reset. Only trivially destructible objects are kept in the
+    // arena, so resetting it just rewinds to the first block. The blocks are kept when the arena is reset, so filling
+    // it again doesn't allocate.
+    class Arena {
+
+    public:
+        Arena() = default;
+        Arena(const Arena &other) = delete;
+        Arena &operator=(const Arena &other) = delete;
+        ~Arena();
+
+        void*    allocate(size_t size, size_t alignment);
+        void     discard(size_t size);
+        void     reset();
+
+        /**
+         * Allocates an uninitialized array of trivially copyable items in the arena.
+         *
+         * @param count The number of items.
+         * @return The array.
+         */
+        template<typename T>
+        T* allocateArray(size_t count) {
+            static_assert(std::is_trivially_copyable<T>::value, "Arena arrays must be trivially copyable");
+            return static_cast<T*>(this->allocate(sizeof(T) * count, alignof(T)));
+        }
+
+        /**
+         * Copies an array of trivially copyable items, such as the characters of a string, into the arena.
+         *
+         * @param items The items.
+         * @param count The number of items.
+         * @return The copy.
+         */
+        template<typename T>
+        T* copy(const T* items, size_t count) {
+            T* copy = this->allocateArray<T>(count);
+            if(count > 0)
+                std::memcpy(copy, items, sizeof(T) * count);
+            return copy;
+        }
+
+        /**
+         * Constructs an object in the arena. The object is never destroyed, its memory is reused once the arena is
+         * reset, so it must not own anything outside the arena.
+         *
+         * @param args The arguments passed to the object's constructor.
+         * @return The object.
+         */
+        template<typename T, typename... Args>
+        T* create(Args&&... args) {
+            static_assert(std::is_trivially_destructible<T>::value, "Arena objects must be trivially destructible");
+            void* memory = this->allocate(sizeof(T), alignof(T));
+            return new(memory) T(std::forward<Args>(args)...);
+        }
+
+        // accessors
+        uint64_t getCapacity();
+        uint64_t getUsed();
+        uint64_t getWasted() { return this->wasted; }
+
+    private:
+        static const size_t BLOCK_SIZE = 1048576;       // bytes in each block
+        static const size_t LARGE_SIZE = BLOCK_SIZE / 8; // allocations of more bytes get a block of their own
+
+        std::vector<char*> blocks;           // blocks of memory, in the order they were filled
+        size_t block = 0;                    // index of the block being filled
+        size_t offset = 0;                   // bytes of the block being filled which are in use
+        std::vector<char*> largeBlocks;      // blocks of the large allocations, freed when the arena is reset
+        uint64_t largeSize = 0;              // bytes in the large blocks
+        uint64_t wasted = 0;                 // bytes handed out which are no longer in use
+
+    };
+
+}
+
+#endif //TFC_ARENA_H
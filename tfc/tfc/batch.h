@@ -0,0 +1,54 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TFC_BATCH_H
+#define TFC_BATCH_H
+
+#include <string>
+#include <tfc/writer.h>
+
+namespace Tfc {
+
+    // pre-declarations
+    class File;
+
+    class WriteBatch {
+
+    public:
+        ~WriteBatch();
+
+        uint32_t    addBlob(const std::string &name, char* bytes, uint64_t size);
+        void        attachTag(uint32_t nonce, const std::string &tag);
+        void        commit();
+        void        deleteBlob(uint32_t nonce);
+        BlobWriter* writer(const std::string &name);
+
+    private:
+        explicit WriteBatch(File* file);
+
+        File* file;        // file the batch applies to
+        bool done = false; // whether the batch has been committed
+
+        void        check();
+
+        friend class File;
+
+    };
+
+}
+
+#endif //TFC_BATCH_H
@@ -0,0 +1,83 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TFC_BITMAP_H
+#define TFC_BITMAP_H
+
+#include <cstdint>
+#include <vector>
+
+namespace Tfc {
+
+    // pre-declarations
+    class Buffer;
+    class Cursor;
+
+    // a compressed set of uint32s, split like a Roaring bitmap into containers which each hold the values sharing their
+    // upper 16 bits, as a sorted array while they are sparse and as a bitset once they are dense
+    class Bitmap {
+
+    public:
+        void     add(uint32_t value);
+        bool     contains(uint32_t value) const;
+        void     decode(Cursor &cursor);
+        void     encode(Buffer &buffer) const;
+        void     intersect(const Bitmap &other);
+        bool     next(uint32_t from, uint32_t &value) const;
+        bool     nextAbsent(uint32_t from, uint32_t &value) const;
+        bool     remove(uint32_t value);
+        uint64_t size() const;
+        void     subtract(const Bitmap &other);
+        void     unite(const Bitmap &other);
+        std::vector<uint32_t> values() const;
+
+        // accessors
+        bool empty() const { return this->containers.empty(); }
+
+    private:
+        struct Container {
+            uint16_t key = 0;             // upper 16 bits of the values
+            uint32_t cardinality = 0;     // number of values
+            std::vector<uint16_t> array;  // lower 16 bits of the values in ascending order, while sparse
+            std::vector<uint64_t> bits;   // a bit for each possible lower 16 bits, once dense
+        };
+
+        // container sizes
+        static const uint32_t MAX_ARRAY_SIZE = 4096; // a container with more values is a bitset
+        static const uint32_t BITSET_WORDS = 1024;   // 65536 bits
+
+        std::vector<Container> containers; // containers in ascending order of key
+
+        std::vector<Container>::iterator find(uint16_t key);
+        std::vector<Container>::const_iterator find(uint16_t key) const;
+
+        static void     andContainer(Container &container, const Container &other);
+        static uint32_t andNotWords(uint64_t* words, const uint64_t* other);
+        static void     andNotContainer(Container &container, const Container &other);
+        static uint32_t andWords(uint64_t* words, const uint64_t* other);
+        static uint32_t countBits(const uint64_t* words);
+        static void     normalize(Container &container);
+        static void     orContainer(Container &container, const Container &other);
+        static uint32_t orWords(uint64_t* words, const uint64_t* other);
+        static void     toArray(Container &container);
+        static void     toBitset(Container &container);
+
+    };
+
+}
+
+#endif //TFC_BITMAP_H
@@ -0,0 +1,49 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TFC_BUFFER_H
+#define TFC_BUFFER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Tfc {
+
+    class Buffer {
+
+    public:
+        void     clear();
+        void     writeBytes(const char* bytes, uint64_t size);
+        void     writeString(const std::string &value);
+        void     writeUInt8(uint8_t value);
+        void     writeUInt16(uint16_t value);
+        void     writeUInt32(uint32_t value);
+        void     writeUInt64(uint64_t value);
+
+        // accessors
+        char*    getData() { return this->bytes.data(); }
+        uint64_t getSize() { return this->bytes.size(); }
+
+    private:
+        std::vector<char> bytes; // bytes written so far
+
+    };
+
+}
+
+#endif //TFC_BUFFER_H
@@ -0,0 +1,49 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TFC_CHUNKER_H
+#define TFC_CHUNKER_H
+
+#include <cstdint>
+
+namespace Tfc {
+
+    // splits bytes into content-defined chunks with FastCDC, so that an insertion or deletion only changes the chunks
+    // around it and the rest of the bytes still split into the same chunks
+    class Chunker {
+
+    public:
+        static uint64_t cut(const char* bytes, uint64_t size, bool final);
+
+        // chunk sizes (in bytes)
+        static const uint64_t MIN_CHUNK_SIZE = 16384;
+        static const uint64_t AVG_CHUNK_SIZE = 65536;
+        static const uint64_t MAX_CHUNK_SIZE = 262144;
+
+    private:
+        // rolling hash bits which must be zero for a cut point, more before the average size than after it so that
+        // chunk sizes cluster around the average
+        static const uint64_t MASK_SMALL = 0xFFFFC00000000000; // 18 bits
+        static const uint64_t MASK_LARGE = 0xFFFC000000000000; // 14 bits
+
+        static const uint64_t* gear();
+
+    };
+
+}
+
+#endif //TFC_CHUNKER_H
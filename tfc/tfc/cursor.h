@@ -0,0 +1,53 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TFC_CURSOR_H
+#define TFC_CURSOR_H
+
+#include <cstdint>
+#include <string>
+
+namespace Tfc {
+
+    class Cursor {
+
+    public:
+        Cursor(const char* data, uint64_t size);
+
+        const char* readBytes(uint64_t size);
+        std::string readString();
+        const char* readString(uint32_t &length);
+        uint8_t     readUInt8();
+        uint16_t    readUInt16();
+        uint32_t    readUInt32();
+        void        readUInt32s(uint32_t* values, uint64_t count);
+        uint64_t    readUInt64();
+
+        // accessors
+        uint64_t getPosition() { return this->position; }
+        uint64_t getRemaining() { return this->size - this->position; }
+
+    private:
+        const char* data; // start of the buffer
+        uint64_t size;    // size of the buffer in bytes
+        uint64_t position = 0; // offset of the next byte to read
+
+    };
+
+}
+
+#endif //TFC_CURSOR_H
@@ -22,8 +22,21 @@
 #include <fstream>
 #include <arpa/inet.h>
 #include <chrono>
+#include <tfc/allocator.h>
+#include <tfc/arena.h>
+#include <tfc/batch.h>
+#include <tfc/buffer.h>
+#include <tfc/cursor.h>
 #include <tfc/exception.h>
+#include <tfc/journal.h>
+#include <tfc/query.h>
+#include <tfc/reader.h>
 #include <tfc/table.h>
+#include <tfc/writer.h>
+
+// pre-declarations of the zstd contexts
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
 
 namespace Tfc {
 
@@ -40,42 +53,114 @@ namespace Tfc {
     };
 
 
+    /*
+     * A container file. Any number of processes can read a container while one process edits it. Readers take no locks:
+     * the tables are never rewritten in place, and readers only ever see the tables of a table root which has been
+     * committed. The blocks of deleted blobs are overwritten and reused as soon as the deletion is committed, without
+     * waiting for readers, so a reader which is streaming a blob while another process deletes it may read zeroes or
+     * another blob's bytes.
+     *
+     * The records returned by READ operations belong to the in-memory tables. They are only valid while the file stays
+     * in READ mode: a mode switch or a rollback may read the tables again, and edits may rebuild them, which frees the
+     * old records. A record's nonce, or a copy of what is needed from it, must be kept instead to use it afterwards.
+     */
     class File {
 
     public:
         explicit File(const std::string &filename);
+        ~File();
 
         uint32_t                 addBlob(const std::string &name, char* bytes, uint64_t size);
         void                     attachTag(uint32_t nonce, const std::string &tag);
+        WriteBatch*              batch();
+        void                     begin();
+        void                     commit();
         void                     deleteBlob(uint32_t nonce);
+        std::vector<BlobRecord*> difference(const std::vector<std::string> &tags,
+                                            const std::vector<std::string> &excluded);
         bool                     doesExist();
+        std::vector<BlobRecord*> findBlobsByName(const std::string &name);
+        std::vector<TagRecord*>  findTags(const std::string &pattern);
+        uint32_t                 getBlockSize();
         FileMode              getMode();
-        void                     init();
+        void                     init(uint32_t blockSize = DEFAULT_BLOCK_SIZE);
         std::vector<BlobRecord*> intersection(const std::vector<std::string> &tags);
+        bool                     isChunking();
+        bool                     isCompressing();
+        bool                     isDeduplicating();
         bool                     isEncrypted();
         bool                     isUnlocked();
+        static bool              isValidBlockSize(uint32_t blockSize);
         std::vector<BlobRecord*> listBlobs();
         std::vector<TagRecord*>  listTags();
         void                     mode(FileMode mode);
+        BlobQuery*               query(const std::string &expression);
         Blob*             readBlob(uint32_t nonce);
+        BlobReader*              reader(uint32_t nonce);
+        void                     rollback();
+        void                     setChunking(bool enabled);
+        void                     setCompression(bool enabled);
+        void                     setDeduplication(bool enabled);
+        void                     sync();
+        std::vector<BlobRecord*> unionOf(const std::vector<std::string> &tags);
+        BlobWriter*              writer(const std::string &name);
+
+        // block sizes (in bytes)
+        static const uint32_t DEFAULT_BLOCK_SIZE = 4096;
+        static const uint32_t MAX_BLOCK_SIZE = 1048576;
+        static const uint32_t MIN_BLOCK_SIZE = 512;
 
     private:
 
+        // types of entries in the table log
+        enum LogEntryType {
+            BLOB_ADD = 1,
+            BLOB_DELETE = 2,
+            TAG_ADD = 3,
+            TAG_ATTACH = 4
+        };
+
         // file constants
-        const uint32_t FILE_VERSION = 1;
+        const uint32_t FILE_VERSION = 9;
         const uint32_t MAGIC_NUMBER = 0xE621126E;
 
         // header field lengths (in bytes)
-        const unsigned int BLOCK_DATA_SIZE = 512;
         const unsigned int BLOCK_LIST_COUNT_SIZE = 4;
-        const unsigned int BLOCK_NEXT_SIZE = 8;
-        const unsigned int BLOCK_SIZE = 520;
+        const unsigned int BLOCK_SIZE_LEN = 4;
+        const unsigned int CHUNK_ENTRY_SIZE = 12;
         const unsigned int DEK_LEN = 32;
         const unsigned int FILE_VERSION_LEN = 4;
-        const unsigned int HASH_BUFFER_SIZE = 64;
+        const unsigned int FREE_MAP_HEADER_SIZE = 16;
+        const unsigned int FREE_MAP_EXTENT_SIZE = 8;
         const unsigned int HASH_LEN = 32;
         const unsigned int MAGIC_NUMBER_LEN = 4;
         const unsigned int NONCE_LEN = 4;
+        const unsigned int TABLE_ROOT_LEN = 24;
+
+        // table log sizes (in bytes)
+        const unsigned int LOG_ENTRY_HEADER_SIZE = 5;   // entry type and payload length
+        const unsigned int LOG_ENTRY_CHECKSUM_SIZE = 8;
+        const uint64_t     MIN_LOG_SIZE = 65536;        // smallest capacity given to a new table log
+
+        // number of times the tables are read before giving up on a writer which keeps moving them
+        const unsigned int MAX_LOAD_ATTEMPTS = 8;
+
+        // number of bytes of two blobs compared at a time when looking for duplicates
+        const uint64_t DEDUP_COMPARE_SIZE = 1048576;
+
+        // compression settings
+        const int      COMPRESSION_LEVEL = 3;           // zstd compression level
+        const uint32_t COMPRESSION_FRAME_SIZE = 131072; // bytes of a blob compressed into each frame
+        const uint32_t MIN_COMPRESSION_SAVING = 8;      // a blob whose first frame shrinks by less than 1/8 isn't compressed
+
+        // edit distances of fuzzy tag searches
+        const uint32_t DEFAULT_FUZZY_DISTANCE = 1;      // used when a pattern ends in ~ without a distance
+        const uint32_t MAX_FUZZY_DISTANCE = 3;          // larger distances match nearly every short tag
+
+        // journal group commit thresholds
+        const uint32_t GROUP_COMMIT_OPERATIONS = 64;    // table log flushes per group
+        const uint64_t GROUP_COMMIT_SIZE = 4194304;     // journaled bytes per group
+        const std::chrono::milliseconds GROUP_COMMIT_INTERVAL = std::chrono::milliseconds(1000); // age of a group's first flush
 
         // file vars
         FileMode op;           // current operation mode
@@ -84,14 +169,33 @@ namespace Tfc {
         bool encrypted = false;   // whether the file is encrypted
         bool unlocked = true;     // whether the file is unlocked (true if unencrypted)
         bool exists = false;      // whether the file exists in the filesystem
-        uint32_t blockCount = 0;  // number of blocks in the block list
+        uint32_t blockSize = DEFAULT_BLOCK_SIZE; // size of a block's data in bytes
+        bool deduplication = false; // whether new blobs share the blocks of identical blobs
+        bool chunking = false;      // whether new blobs are split into chunks which share the blocks of identical chunks
+        bool compression = false;   // whether new blobs are compressed
 
         // file section byte positions
         std::streampos headerPos;     // start position of header
-        std::streampos tagTablePos;   // start position of tag table
-        std::streampos blobTablePos;  // start position of blob table
         std::streampos blockListPos;   // start position of blob list
 
+        // table root, the runs of blocks holding the tables
+        Extent snapshotExtent = { 0, 0 }; // blocks holding the tag table, blob table and free map
+        Extent logExtent = { 0, 0 };      // blocks holding the table log
+        uint64_t logSalt = 0;             // checksum seed of the entries in the current table log
+        uint64_t logSize = 0;             // number of bytes written to the table log
+        Buffer pendingLog;                // table log entries which haven't been written yet
+        WriteBatch* openBatch = nullptr;  // batch deferring writes to the table log, null if there is none
+        bool transaction = false;         // whether a transaction is deferring writes to the table log
+        uint32_t diskBlockCount = 0;      // block count last written to the file
+
+        // write-ahead journal for the tables and header
+        Journal* journal = nullptr;
+        uint32_t pendingOperations = 0;   // table log flushes since the journal was last committed
+        std::chrono::steady_clock::time_point groupStart; // when the first of the pending flushes was made
+        std::vector<Extent> pendingFree;  // blocks to free once the journal is committed
+        std::vector<Extent> pendingZero;  // blocks to overwrite once the journal is committed
+        bool rootPending = false;         // whether the table root must be written when the journal is committed
+
         // next auto-increment table nonces
         uint32_t tagTableNextNonce;   // next nonce for a new tag
         uint32_t blobTableNextNonce;  // next nonce for a new blob
@@ -99,21 +203,76 @@ namespace Tfc {
         // in-memory tables
         TagTable* tagTable = nullptr;
         BlobTable* blobTable = nullptr;
+        Arena arena;                  // owns the tables' records, freed together when the tables are read again
+        bool tablesLoaded = false;    // whether the tables match the file as it was last read or written
+
+        // in-memory free block index
+        BlockAllocator* allocator = nullptr;
 
+        // compression contexts, created when first needed
+        ZSTD_CCtx_s* compressor = nullptr;
+        ZSTD_DCtx_s* decompressor = nullptr;
+        std::vector<char> frameBuffer; // stored bytes of the frame being decompressed
+
+        // memory-mapped view of the file in READ mode
+        const char* mapping = nullptr; // start of the mapping, null if the file is read through the stream
+        uint64_t mappingSize = 0;      // size of the mapping in bytes
+        uint64_t mappingPos = 0;       // position of the cursor in the mapping
+
+        uint32_t    addRecord(BlobRecord* pending);
         void        analyze();
-        uint64_t    hash(char* bytes, size_t size);
+        bool        applyLogEntry(uint8_t type, Cursor &cursor);
+        std::streampos blockPos(uint32_t block);
+        uint32_t    blocksFor(uint64_t size);
+        void        buildAllocator(uint32_t blockCount);
+        void        commitGroup();
+        BlobRecord* decodeBlob(Cursor &cursor, bool indexed);
+        void        decodeTables(Cursor &cursor);
+        void        encodeBlob(Buffer &buffer, BlobRecord* record);
+        void        encodeFreeMap(Buffer &buffer);
+        void        encodeTables(Buffer &buffer);
+        void        endBatch();
+        BlobRecord* findDuplicate(uint64_t hash, uint64_t size, const char* bytes, BlobRecord* pending);
+        void        flushLog();
+        const char* intern(const std::string &name);
+        bool        isShared(BlobRecord* record);
         void        jump(std::streampos length);
         void        jumpBack(std::streampos length);
+        void        linkTag(BlobRecord* blob, TagRecord* tag);
+        void        loadTables();
+        void        logEntry(LogEntryType type, Buffer &payload);
+        std::vector<TagRecord*> lookupTags(const std::vector<std::string> &tags);
+        void        map();
         void        next(std::streampos length);
-        std::string readString();
+        bool        readBytes(char* bytes, uint64_t size);
+        void        readContent(BlobRecord* record, uint64_t offset, char* bytes, uint64_t size);
+        void        readExtents(const Span<Extent> &extents, const Span<Chunk> &chunks, uint64_t offset, char* bytes,
+                                uint64_t size);
+        uint64_t    readFrame(BlobRecord* record, uint32_t index, uint64_t storedOffset, char* bytes);
+        bool        readFreeMap(Cursor &cursor, uint32_t blockCount);
+        Cursor      readRegion(std::streampos start, uint64_t size, std::vector<char> &buffer);
         uint32_t    readUInt32();
-        uint64_t    readUInt64();
+        std::vector<BlobRecord*> recordsFor(const Bitmap &nonces);
+        void        releaseBlocks(const Extent &extent, bool overwrite);
+        void        reloadTables();
+        void        removeBlob(BlobRecord* record, bool committed);
+        void        replayLog(Cursor &cursor);
         void        reset();
-        void        writeBlobTable();
-        void        writeString(const std::string &value);
-        void        writeTagTable();
+        bool        tablesMoved(bool checkBlockCount);
+        bool        tablesStale();
+        std::streampos tell();
+        void        unmap();
+        void        writeAt(std::streampos pos, const char* bytes, uint64_t size);
+        void        writeBlockCount();
+        void        writeBytes(const char* bytes, uint64_t size);
+        void        writeRoot();
+        void        writeSnapshot();
         void        writeUInt32(const uint32_t &value);
-        void        writeUInt64(const uint64_t &value);
+
+        friend class BlobQuery;
+        friend class BlobReader;
+        friend class BlobWriter;
+        friend class WriteBatch;
     };
 
 }
@@ -0,0 +1,76 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TFC_INDEX_H
+#define TFC_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Tfc {
+
+    // a hash table from 64-bit keys to 32-bit values, which can hold a key more than once. The entries are stored in
+    // two flat arrays and collisions are resolved by probing the next slots, so a lookup reads a few adjacent slots
+    // instead of following a list node per entry
+    class HashIndex {
+
+    public:
+        void   insert(uint64_t key, uint32_t value);
+        bool   remove(uint64_t key, uint32_t value);
+        void   reserve(size_t count);
+
+        /**
+         * Calls a function with each value held under a key.
+         *
+         * @param key The key.
+         * @param visit The function, which is given each value.
+         */
+        template<typename Visitor>
+        void find(uint64_t key, Visitor visit) const {
+            if(this->values.empty())
+                return;
+            size_t mask = this->values.size() - 1;
+            for(size_t slot = this->home(key); this->values[slot] != EMPTY; slot = (slot + 1) & mask) {
+                if(this->keys[slot] == key && this->values[slot] != REMOVED)
+                    visit(this->values[slot]);
+            }
+        }
+
+        // accessors
+        size_t size() const { return this->count; }
+
+        // values which mark a slot as empty, or as removed so that probes still go past it. They can't be stored
+        static const uint32_t EMPTY = UINT32_MAX;
+        static const uint32_t REMOVED = UINT32_MAX - 1;
+
+    private:
+        static const size_t MIN_SLOTS = 16;
+
+        std::vector<uint64_t> keys;   // key of each slot
+        std::vector<uint32_t> values; // value of each slot, a power of two of them or none
+        size_t count = 0;             // number of slots holding values
+        size_t used = 0;              // number of slots holding values or removed
+
+        size_t home(uint64_t key) const;
+        void   rehash(size_t count);
+
+    };
+
+}
+
+#endif //TFC_INDEX_H
@@ -20,6 +20,7 @@
 
 #include <string>
 #include <fstream>
+#include <vector>
 
 namespace Tfc {
 
@@ -30,15 +31,50 @@ namespace Tfc {
         ERROR
     };
 
+    // a write to the container which has been journaled but may not have been made yet
+    struct JournalOperation {
+        uint64_t start;          // position in the container to write at
+        std::vector<char> data;  // bytes to write
+    };
+
     class Journal {
 
     public:
         explicit Journal(const std::string &filename);
+        ~Journal();
+
+        void     add(uint64_t start, const char* bytes, uint64_t size);
+        void     checkpoint(std::fstream &container);
+        void     close();
+        void     commit(std::fstream &container);
+        void     discard();
+        void     open(const std::string &containerFilename);
+
+        // accessors
+        size_t   getOperationCount() { return this->operations.size(); }
+        uint64_t getPendingSize() { return this->pendingSize; }
 
     private:
+
+        // file constants
+        const uint32_t FILE_VERSION = 1;
+        const uint32_t MAGIC_NUMBER = 0xE926629E;
+
+        // field lengths (in bytes)
+        const unsigned int HEADER_SIZE = 9;            // magic number, version and state
+        const unsigned int OPERATION_HEADER_SIZE = 17; // state, start position and size
+
         std::string filename;
         bool exists;
-        std::fstream stream;
+        int fd = -1;          // journal file, locked while it is open
+        int containerFd = -1; // container file, used to flush the container to disk
+        std::vector<JournalOperation> operations; // writes which haven't been committed yet
+        uint64_t pendingSize = 0; // number of bytes in the uncommitted writes
+
+        bool     lock(int fd);
+        bool     read(int fd, std::vector<JournalOperation> &operations);
+        void     replay();
+        void     write(const std::vector<JournalOperation> &operations);
 
     };
 
@@ -0,0 +1,92 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TFC_QUERY_H
+#define TFC_QUERY_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <tfc/bitmap.h>
+#include <tfc/record.h>
+
+namespace Tfc {
+
+    // pre-declarations
+    class File;
+
+    // a boolean expression of tags, such as "(cat OR dog) AND NOT blurry", whose matching blobs are found one at a time
+    // in ascending order of nonce
+    class BlobQuery {
+
+    public:
+        std::vector<BlobRecord*> all();
+        BlobRecord*              next();
+
+        // accessors
+        uint64_t getEstimate() { return this->root->estimate; }
+
+    private:
+        explicit BlobQuery(File* file, const std::string &expression);
+
+        // kinds of nodes in a query
+        enum NodeType {
+            ALL,  // every nonce given to a blob so far, deleted or not
+            AND,  // blobs matching every child
+            NOT,  // blobs not matching the child
+            OR,   // blobs matching any child
+            TAG   // blobs with a tag
+        };
+
+        struct Node {
+            NodeType type;
+            const Bitmap* blobs = nullptr; // nonces of the blobs with the tag, if a TAG node
+            std::vector<Node*> children;
+            uint64_t estimate = 0;         // most blobs which can match, used to order the children
+
+            // result of the last seek, which later seeks reuse while it still applies
+            bool cached = false;
+            uint32_t target = 0;           // nonce which was sought
+            bool found = false;            // whether a match was found
+            uint32_t result = 0;           // smallest matching nonce which is at least target
+        };
+
+        File* file;                       // file the blobs are found in
+        Bitmap noBlobs;                   // blobs of the tags in the expression which don't exist
+        std::deque<Node> nodes;           // every node of the query
+        Node* root = nullptr;             // node the results come from
+        std::vector<std::string> tokens;  // words and parentheses of the expression
+        size_t token = 0;                 // index of the next token to parse
+        uint32_t position = 0;            // smallest nonce the next result can have
+        bool done = false;                // whether every result has been found
+
+        Node* node(NodeType type);
+        Node* parseAnd();
+        Node* parseOr();
+        Node* parseUnary();
+        Node* plan(Node* node);
+        bool  seek(Node* node, uint32_t target, uint32_t &value);
+        bool  skip(Node* node, uint32_t target, uint32_t &value);
+        void  tokenize(const std::string &expression);
+
+        friend class File;
+
+    };
+
+}
+
+#endif //TFC_QUERY_H
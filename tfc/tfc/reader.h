@@ -0,0 +1,60 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TFC_READER_H
+#define TFC_READER_H
+
+#include <string>
+#include <vector>
+#include <tfc/record.h>
+
+namespace Tfc {
+
+    // pre-declarations
+    class File;
+
+    class BlobReader {
+
+    public:
+        uint64_t read(char* bytes, uint64_t size);
+        uint64_t pread(uint64_t offset, char* bytes, uint64_t size);
+        void     seek(uint64_t offset);
+        const char* view(uint64_t offset, uint64_t &size);
+
+        // accessors
+        uint64_t    getPosition() { return this->position; }
+        BlobRecord* getRecord() { return this->record; }
+        uint64_t    getSize() { return this->record->getSize(); }
+
+    private:
+        explicit BlobReader(File* file, BlobRecord* record);
+
+        File* file;                    // file the blob is read from
+        BlobRecord* record;            // record of the blob being read
+        uint64_t position = 0;         // byte offset of the next read()
+        std::vector<uint64_t> offsets; // byte offset in the blob at which each run of blocks starts, then the end
+        std::vector<uint64_t> frameOffsets; // byte offset in the stored bytes at which each frame starts, if compressed
+        std::vector<char> frame;       // bytes of the last frame which was decompressed
+        uint32_t frameIndex = UINT32_MAX; // index of the frame held in frame, UINT32_MAX if there is none
+
+        friend class File;
+
+    };
+
+}
+
+#endif //TFC_READER_H
@@ -22,12 +22,63 @@
 #include <cstring>
 #include <vector>
 #include <string>
+#include <tfc/arena.h>
+#include <tfc/bitmap.h>
 
 namespace Tfc {
 
     // pre-declarations
     class TagRecord;
 
+    // a run of items which a record refers to without owning them. The tables' records refer to runs in the file's
+    // arena, while a record which is still being built can refer to the vectors it is built from
+    template<typename T>
+    class Span {
+
+    public:
+        Span() = default;
+        Span(T* items, uint32_t count) : items(items), count(count) { }
+        explicit Span(std::vector<T> &items) : items(items.data()), count(static_cast<uint32_t>(items.size())) { }
+
+        T&     back() const { return this->items[this->count - 1]; }
+        T*     begin() const { return this->items; }
+        T*     data() const { return this->items; }
+        bool   empty() const { return this->count == 0; }
+        T*     end() const { return this->items + this->count; }
+        T&     front() const { return this->items[0]; }
+        size_t size() const { return this->count; }
+        T&     operator[](size_t index) const { return this->items[index]; }
+
+    private:
+        T* items = nullptr; // first item
+        uint32_t count = 0; // number of items
+
+    };
+
+    // algorithms used to hash a blob's bytes
+    enum HashAlgorithm {
+        XXHASH_64 = 1,  // XXH64, seeded with the container's magic number
+        XXHASH3_64 = 2  // XXH3-64, seeded with the container's magic number
+    };
+
+    // codecs used to compress a blob's bytes
+    enum Codec {
+        UNCOMPRESSED = 0, // stored as is
+        ZSTD = 1          // split into Zstandard frames, each of which can be decompressed on its own
+    };
+
+    // a contiguous run of blocks in the block list
+    struct Extent {
+        uint32_t start;  // index of the first block
+        uint32_t length; // number of blocks
+    };
+
+    // a content-defined piece of a chunked blob, stored in its own run of blocks which identical chunks share
+    struct Chunk {
+        uint32_t size; // number of bytes
+        uint64_t hash; // XXH3-64 hash of the bytes, seeded with the container's magic number
+    };
+
     // record base class
     class Record {
 
@@ -49,21 +100,40 @@ namespace Tfc {
     class BlobRecord : public Record {
 
     public:
-        BlobRecord(uint32_t nonce, const std::string &name, uint64_t hash, std::streampos start, uint64_t size);
+        BlobRecord(uint32_t nonce, const char* name, uint32_t nameLength, HashAlgorithm hashAlgorithm, uint64_t hash,
+                   uint64_t size);
 
-        std::string getName() { return this->name; }
+        std::string getName() { return std::string(this->name, this->nameLength); }
         uint64_t getHash() { return this->hash; }
-        std::streampos getStart() { return this->start; }
-        std::vector<Tfc::TagRecord*>* getTags() { return &this->tags; }
+        HashAlgorithm getHashAlgorithm() { return this->hashAlgorithm; }
+        Span<Chunk>* getChunks() { return &this->chunks; }
+        Codec getCodec() { return this->codec; }
+        Span<Extent>* getExtents() { return &this->extents; }
+        uint32_t getFrameSize() { return this->frameSize; }
+        Span<uint32_t>* getFrames() { return &this->frames; }
+        Span<Tfc::TagRecord*>* getTags() { return &this->tags; }
         uint64_t getSize() { return this->size; }
-        void addTag(Tfc::TagRecord* tag);
+        uint64_t getArenaSize();
+        void addTag(Tfc::TagRecord* tag, Arena &arena);
+        void copyInto(Arena &arena);
+        void copyStorage(BlobRecord* other);
+        void setCompression(Codec codec, uint32_t frameSize);
 
     private:
-        std::string name;                   // original file name
+        const char* name;                   // original file name, not null terminated
+        uint32_t nameLength;                // number of bytes in the name
+        HashAlgorithm hashAlgorithm;        // algorithm the hash was made with
         uint64_t hash;                      // file hash
         uint64_t size;                      // file size
-        std::streampos start;               // starting byte position of the blob
-        std::vector<Tfc::TagRecord* > tags; // vector of tag pointers
+        Span<Extent> extents;               // runs of blocks holding the blob's bytes, in order
+        Span<Chunk> chunks;                 // the chunk each run holds if the blob is chunked, otherwise empty
+        Codec codec = Codec::UNCOMPRESSED;  // codec the stored bytes are compressed with
+        uint32_t frameSize = 0;             // number of the blob's bytes in each frame, if compressed
+        Span<uint32_t> frames;              // number of stored bytes of each frame, if compressed
+        Span<Tfc::TagRecord*> tags;         // tags of the blob
+        uint32_t tagCapacity = 0;           // number of tags the run of tags has room for, 0 if it has no spare room
+
+        static const uint32_t MIN_TAG_CAPACITY = 4; // tags which fit in the first run given to a blob's tags
 
         friend class BlobTable;
 
@@ -72,16 +142,19 @@ namespace Tfc {
     class TagRecord : public Record {
 
     public:
-        TagRecord(uint32_t nonce, const std::string &name);
+        TagRecord(uint32_t nonce, const char* name, uint32_t nameLength);
 
-        const std::string getName() { return this->name; }
-        std::vector<Tfc::BlobRecord*>* getBlobs() { return &this->blobs; }
+        const std::string getName() { return std::string(this->name, this->nameLength); }
+        Bitmap* getBlobs() { return this->blobs; }
+        uint64_t getArenaSize() { return sizeof(TagRecord) + this->nameLength; }
 
         void addBlob(Tfc::BlobRecord* blob);
+        bool removeBlob(Tfc::BlobRecord* blob);
 
     private:
-        std::string name;
-        std::vector<Tfc::BlobRecord*> blobs;
+        const char* name;    // tag name, not null terminated
+        uint32_t nameLength; // number of bytes in the name
+        Bitmap* blobs;       // nonces of the blobs with this tag, kept by the tag table
 
         friend class TagTable;
 
@@ -18,43 +18,107 @@
 #ifndef TFC_TABLE_H
 #define TFC_TABLE_H
 
+#include <deque>
+#include <vector>
+#include <tfc/index.h>
 #include <tfc/record.h>
+#include <tfc/trie.h>
 
 namespace Tfc {
 
+    // a stored chunk and the number of times blobs refer to it
+    struct ChunkEntry {
+        uint64_t hash;       // XXH3-64 hash of the chunk's bytes
+        uint32_t size;       // number of bytes
+        Extent extent;       // run of blocks holding the chunk
+        uint32_t references; // number of times the chunk appears in blobs
+    };
+
+    // iterates over the rows of a table indexed by nonce in ascending order of nonce, skipping the nonces without rows
+    template<typename T>
+    class RowIterator {
+
+    public:
+        RowIterator(const std::vector<T*>* rows, size_t index) : rows(rows), index(index) { this->skip(); }
+
+        T*           operator*() const { return (*this->rows)[this->index]; }
+        RowIterator& operator++() { this->index++; this->skip(); return *this; }
+        bool         operator!=(const RowIterator &other) const { return this->index != other.index; }
+        bool         operator==(const RowIterator &other) const { return this->index == other.index; }
+
+    private:
+        const std::vector<T*>* rows; // rows of the table
+        size_t index;                // nonce of the current row
+
+        void skip() {
+            while(this->index < this->rows->size() && (*this->rows)[this->index] == nullptr)
+                this->index++;
+        }
+
+    };
+
+    // the blobs of a container. Rows are kept in a vector indexed by nonce, since nonces are handed out in ascending
+    // order, and the indexes over them are flat arrays rather than a node per entry
     class BlobTable {
 
     public:
         void add(BlobRecord *row);
         BlobRecord *get(uint32_t nonce);
-        void remove(BlobRecord* record);
+        std::vector<BlobRecord*> getByHash(uint64_t hash);
+        std::vector<BlobRecord*> getByName(const std::string &name);
+        std::vector<BlobRecord*> getByNamePrefix(const std::string &prefix);
+        std::vector<ChunkEntry> getChunksByHash(uint64_t hash);
+        std::vector<Extent> remove(BlobRecord* record);
+        void reserve(uint32_t count);
         uint32_t size();
 
-        std::map<uint32_t, BlobRecord *>::iterator begin();
-        std::map<uint32_t, BlobRecord *>::iterator end();
+        RowIterator<BlobRecord> begin();
+        RowIterator<BlobRecord> end();
+        RowIterator<BlobRecord> lowerBound(uint32_t nonce);
 
     private:
         uint32_t _size = 0;
-        std::map<uint32_t, BlobRecord *> map;
+        std::vector<BlobRecord*> rows;     // nonce -> row mapping, null where there is no row
+        HashIndex hashIndex;               // content hash -> nonce mapping
+        HashIndex nameHashIndex;           // name hash -> nonce mapping, for exact names
+        std::vector<uint32_t> nameIndex;   // nonces in order of name and then of nonce, followed by unsorted nonces
+        size_t sortedNames = 0;            // number of nonces at the start of the name index which are in order
+        bool namesRemoved = false;         // whether the name index holds nonces whose rows have been removed
+        std::vector<ChunkEntry> chunks;    // stored chunks, those without references are unused
+        std::vector<uint32_t> freeChunks;  // indexes of the unused chunks
+        HashIndex chunkHashIndex;          // chunk hash -> chunk index mapping
+        HashIndex chunkBlockIndex;         // first block -> chunk index mapping
+
+        void sortNames();
+
+        static int      compareName(const BlobRecord* row, const char* name, size_t length);
+        static uint64_t hashName(const char* name, size_t length);
 
     };
 
+    // the tags of a container, indexed by nonce and, through a trie, by name. The table keeps each tag's set of blobs,
+    // so that the records themselves can live in an arena
     class TagTable {
 
     public:
         void add(TagRecord* row);
         TagRecord* get(uint32_t nonce);
-        TagRecord* get(std::string name);
+        TagRecord* get(const std::string &name);
         void remove(TagRecord* record);
         uint32_t size();
 
-        std::map<std::string, TagRecord*>::iterator begin();
-        std::map<std::string, TagRecord*>::iterator end();
+        RowIterator<TagRecord> begin();
+        RowIterator<TagRecord> end();
+
+        // accessors
+        const TagTrie* getTrie() { return &this->trie; }
 
     private:
         uint32_t _size = 0;
-        std::map<std::string, TagRecord*> nameMap;   // name -> row mapping
-        std::map<uint32_t, TagRecord*> nonceMap;     // nonce -> row mapping
+        std::vector<TagRecord*> rows;                // nonce -> row mapping, null where there is no row
+        std::deque<Bitmap> postings;                 // blobs of each tag, which don't move as tags are added
+        std::vector<Bitmap*> freePostings;           // postings of removed tags, reused by new tags
+        TagTrie trie;                                // names for exact, prefix, wildcard and fuzzy lookups
 
     };
 
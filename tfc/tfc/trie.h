@@ -0,0 +1,66 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TFC_TRIE_H
+#define TFC_TRIE_H
+
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace Tfc {
+
+    // pre-declarations
+    class TagRecord;
+
+    // a trie over tag names, for finding tags by prefix, wildcard pattern or edit distance without scanning every name
+    class TagTrie {
+
+    public:
+        TagTrie();
+
+        void add(TagRecord* record);
+        TagRecord* find(const std::string &name) const;
+        std::vector<TagRecord*> match(const std::string &pattern) const;
+        std::vector<TagRecord*> prefixed(const std::string &prefix) const;
+        void remove(TagRecord* record);
+        std::vector<TagRecord*> similar(const std::string &name, uint32_t maxDistance) const;
+
+    private:
+        struct Node {
+            std::vector<std::pair<unsigned char, uint32_t>> children; // next character -> index of the child, sorted
+            TagRecord* record = nullptr;                              // tag whose name ends here, if there is one
+        };
+
+        static const uint32_t NO_NODE = UINT32_MAX;
+
+        std::vector<Node>     nodes;     // every node, the root first
+        std::vector<uint32_t> freeNodes; // nodes pruned by remove(), to be reused by add()
+
+        uint32_t child(uint32_t node, unsigned char c) const;
+        void     collect(uint32_t node, std::vector<TagRecord*> &records) const;
+        void     matchFrom(uint32_t node, const std::string &pattern, size_t index,
+                           std::unordered_set<uint64_t> &visited, std::vector<TagRecord*> &records) const;
+        void     similarFrom(uint32_t node, const std::string &name, const std::vector<uint32_t> &row,
+                             uint32_t maxDistance, std::vector<std::pair<uint32_t, TagRecord*>> &records) const;
+
+    };
+
+}
+
+#endif //TFC_TRIE_H
@@ -0,0 +1,79 @@
+/*
+ * Tagged File Containers
+ * Copyright (C) 2018 Richard Kriesman.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TFC_WRITER_H
+#define TFC_WRITER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <tfc/record.h>
+
+// pre-declaration of the xxHash streaming state
+struct XXH3_state_s;
+
+namespace Tfc {
+
+    // pre-declarations
+    class File;
+
+    class BlobWriter {
+
+    public:
+        ~BlobWriter();
+
+        void     abort();
+        void     append(const char* bytes, uint64_t size);
+        uint32_t commit();
+
+        // accessors
+        uint64_t getSize() { return this->size; }
+
+    private:
+        explicit BlobWriter(File* file, const std::string &name);
+
+        File* file;                         // file the blob is being written to
+        std::string name;                   // display name of the blob
+        uint64_t size = 0;                  // number of bytes appended so far
+        XXH3_state_s* hashState = nullptr;  // hash of the bytes appended so far
+        std::vector<Extent> extents;        // runs of blocks the blob has been written to
+        std::vector<Chunk> chunks;          // the chunk each run holds if the blob is chunked
+        std::vector<Extent> stored;         // runs of blocks holding chunks which were stored for this blob
+        std::unordered_multimap<uint64_t, size_t> storedChunks; // chunk hash -> index of the chunk in chunks
+        std::vector<char> buffer;           // bytes which do not fill a whole block, or a whole chunk, yet
+        std::vector<char> scratch;          // stored chunk being compared with a new chunk
+        std::vector<char> frame;            // bytes which do not fill a whole frame yet, if compressed
+        std::vector<uint32_t> frames;       // number of stored bytes of each frame written so far
+        bool done = false;                  // whether the blob has been committed or aborted
+        bool deduplicate;                   // whether to look for an identical blob to share blocks with
+        bool chunked;                       // whether the blob is split into chunks
+        bool compressed;                    // whether the blob is compressed
+
+        void     check();
+        bool     isStored(const Extent &extent, const char* bytes, uint32_t size);
+        void     writeBlocks(const char* bytes, uint32_t count);
+        void     writeBytes(const char* bytes, uint64_t size);
+        void     writeChunk(const char* bytes, uint32_t size);
+        void     writeFrame(const char* bytes, uint32_t size);
+
+        friend class File;
+
+    };
+
+}
+
+#endif //TFC_WRITER_H